@@ -21,21 +21,37 @@ else {
   !isEmpty(PA_LIB): LIBS += -L$$PA_LIB
   LIBS += -lportaudio
 }
+linux:qtHaveModule(dbus) {
+  QT += dbus
+  DEFINES += HAVE_RTKIT
+}
+alloc_audit {
+  DEFINES += AGBPLAY_ALLOC_AUDIT
+}
 win32 {
   CONFIG += static
   QMAKE_LFLAGS += -static-libgcc -static-libstdc++ -static
+  LIBS += -lavrt
 }
 
 RESOURCES += resources/agbplay.qrc
 
-GUI_CLASS += PianoKeys VUMeter TrackHeader TrackView TrackList
+GUI_CLASS += PianoKeys VUMeter TrackHeader TrackGrid TrackList
 GUI_CLASS += RomView PlayerWindow SongModel Player UiUtils
 GUI_CLASS += AudioThread PlayerControls PlaylistModel RiffWriter
-GUI_CLASS += PreferencesWindow
+GUI_CLASS += PreferencesWindow AllocationAudit MixKernel SongSnapshot
+GUI_CLASS += LatencyProfile OutputResampler ThreadPriority RenderCache
+GUI_CLASS += ExportBudget
+packagesExist(jack) {
+  PKGCONFIG += jack
+  DEFINES += HAVE_JACK
+  GUI_CLASS += JackOutput
+}
 for(F, GUI_CLASS) {
   HEADERS += src/$${F}.h
   SOURCES += src/$${F}.cpp
 }
+HEADERS += src/TripleBuffer.h src/BlockQueue.h src/CommandQueue.h
 
 AGBPLAY += CGBChannel CGBPatterns Debug GameConfig PlayerContext
 AGBPLAY += SequenceReader SoundMixer ReverbEffect LoudnessCalculator
@@ -0,0 +1,184 @@
+#include "AllocationAudit.h"
+
+#ifdef AGBPLAY_ALLOC_AUDIT
+#include "Debug.h"
+#include <QtGlobal>
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+static thread_local bool auditActive = false;
+static thread_local std::size_t auditCount = 0;
+
+// Every replaceable form of operator new is routed through these, so that
+// containers with aligned or nothrow allocation are counted as well.
+static void* allocate(std::size_t size)
+{
+  if (auditActive) {
+    ++auditCount;
+  }
+  return std::malloc(size ? size : 1);
+}
+
+static void* allocateAligned(std::size_t size, std::align_val_t align)
+{
+  if (auditActive) {
+    ++auditCount;
+  }
+  std::size_t alignment = std::max(std::size_t(align), sizeof(void*));
+#ifdef _WIN32
+  return _aligned_malloc(size ? size : 1, alignment);
+#else
+  void* ptr = nullptr;
+  return posix_memalign(&ptr, alignment, size ? size : 1) == 0 ? ptr : nullptr;
+#endif
+}
+
+static void freeAligned(void* ptr)
+{
+#ifdef _WIN32
+  _aligned_free(ptr);
+#else
+  std::free(ptr);
+#endif
+}
+
+void* operator new(std::size_t size)
+{
+  void* ptr = allocate(size);
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void* operator new[](std::size_t size)
+{
+  return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+  return allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+  return allocate(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t align)
+{
+  void* ptr = allocateAligned(size, align);
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void* operator new[](std::size_t size, std::align_val_t align)
+{
+  return operator new(size, align);
+}
+
+void* operator new(std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+  return allocateAligned(size, align);
+}
+
+void* operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+  return allocateAligned(size, align);
+}
+
+void operator delete(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+  freeAligned(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept
+{
+  freeAligned(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept
+{
+  freeAligned(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept
+{
+  freeAligned(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+  freeAligned(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+  freeAligned(ptr);
+}
+
+AllocationAudit::Scope::Scope()
+: wasActive(auditActive)
+{
+  auditActive = true;
+}
+
+AllocationAudit::Scope::~Scope()
+{
+  auditActive = wasActive;
+}
+
+void AllocationAudit::reset()
+{
+  auditCount = 0;
+}
+
+std::size_t AllocationAudit::count()
+{
+  return auditCount;
+}
+
+void AllocationAudit::report(const char* threadName)
+{
+  // The audit build exists to catch regressions, so one is fatal rather
+  // than a line in the log that nobody reads.
+  if (auditCount > 0) {
+    Debug::print("Allocation audit: %zu heap allocations on %s after song init", auditCount, threadName);
+    qFatal("Allocation audit failed: %zu heap allocations on %s after song init", auditCount, threadName);
+  }
+}
+#endif
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+
+// Counts heap allocations made on threads inside an AllocationAudit::Scope.
+// The counters only exist in builds configured with CONFIG+=alloc_audit;
+// otherwise everything here compiles away.
+namespace AllocationAudit {
+#ifdef AGBPLAY_ALLOC_AUDIT
+  class Scope
+  {
+  public:
+    Scope();
+    ~Scope();
+
+  private:
+    bool wasActive;
+  };
+
+  void reset();
+  std::size_t count();
+  void report(const char* threadName);
+#else
+  struct Scope {};
+
+  inline void reset() {}
+  inline std::size_t count() { return 0; }
+  inline void report(const char*) {}
+#endif
+}
@@ -1,9 +1,24 @@
 #include "AudioThread.h"
-#include "ConfigManager.h"
 #include "Xcept.h"
 #include "Debug.h"
 #include "RiffWriter.h"
+#include "AllocationAudit.h"
+#include "ThreadPriority.h"
 #include <QDir>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+
+// Above this speed the track meters are skipped. The levels change too
+// quickly to follow, and the time is better spent keeping up with the
+// sequencer.
+static constexpr double fastForwardSpeed = 4.0;
+
+// Blocks rendered without output per cached block while the engine catches
+// up with a replay. Few enough that the mixer still blocks on the device
+// every block, which is what real-time scheduling requires of it.
+static constexpr std::size_t catchUpBlocks = 4;
 
 AudioThread::AudioThread(Player* player, const QString& name, PlayerContext* ctx)
 : QThread(player),
@@ -13,6 +28,14 @@ AudioThread::AudioThread(Player* player, const QString& name, PlayerContext* ctx
 {
   setObjectName(name);
   setTerminationEnabled(true);
+
+  // Allocate every track buffer up front so that changing songs only moves
+  // buffers between the active list and the spare pool.
+  trackAudio.reserve(maxTracks);
+  spareAudio.reserve(maxTracks);
+  for (std::size_t i = 0; i < maxTracks; i++) {
+    spareAudio.emplace_back(samplesPerBuffer, sample{0.0f, 0.0f});
+  }
 }
 
 AudioThread::~AudioThread()
@@ -22,11 +45,25 @@ AudioThread::~AudioThread()
 void AudioThread::prepare(quint32 addr)
 {
   ctx->InitSong(addr);
-  uint8_t numTracks = static_cast<uint8_t>(ctx->seq.tracks.size());
-  trackAudio.resize(numTracks);
+  resizeTrackAudio(ctx->seq.tracks.size());
+}
+
+void AudioThread::resizeTrackAudio(std::size_t numTracks)
+{
+  while (trackAudio.size() > numTracks) {
+    spareAudio.push_back(std::move(trackAudio.back()));
+    trackAudio.pop_back();
+  }
+  while (trackAudio.size() < numTracks && !spareAudio.empty()) {
+    trackAudio.push_back(std::move(spareAudio.back()));
+    spareAudio.pop_back();
+  }
+  while (trackAudio.size() < numTracks) {
+    // only reachable if the track limit is raised beyond maxTracks
+    trackAudio.emplace_back(samplesPerBuffer, sample{0.0f, 0.0f});
+  }
   for (auto& buffer : trackAudio) {
     std::fill(buffer.begin(), buffer.end(), sample{0.0f, 0.0f});
-    buffer.resize(samplesPerBuffer, sample{0.0f, 0.0f});
   }
 }
 
@@ -45,12 +82,35 @@ bool AudioThread::process()
 PlayerThread::PlayerThread(Player* player)
 : AudioThread(player, "mixer thread", player->ctx.get()),
   silence(samplesPerBuffer, sample{0.0f, 0.0f}),
-  masterAudio(samplesPerBuffer, sample{0.0f, 0.0f})
+  masterAudio(samplesPerBuffer, sample{0.0f, 0.0f}),
+  rampAudio(samplesPerBuffer, sample{0.0f, 0.0f}),
+  rampFrames(std::max<std::size_t>(1, std::size_t(ctx->mixer.GetSampleRate() * 0.005))),
+  blockFrame(0),
+  fastForward(player->speed >= fastForwardSpeed),
+  fade(nullptr),
+  fadeCtx(nullptr),
+  heldCtx(nullptr),
+  fadeBlock(0),
+  fadeBlocks(0),
+  fadeOutEnded(false),
+  replayFrame(0),
+  recording(nullptr),
+  recordStart(0),
+  caughtUpFrame(0),
+  catchingUp(false),
+  skipping(false)
+#ifdef HAVE_JACK
+  , jack(player->jack.get()),
+  jackTracks(0)
+#endif
 {
-  PaError err = Pa_StartStream(player->audioStream);
-  if (err != paNoError) {
-    throw Xcept("Pa_StartStream(): unable to start stream: %s", Pa_GetErrorText(err));
-  }
+  startOutput();
+  resampler.setRates(ctx->mixer.GetSampleRate(), player->outputSampleRate, samplesPerBuffer);
+  outputAudio.resize(resampler.maxOutputFrames(samplesPerBuffer), sample{0.0f, 0.0f});
+  resizeTrackAudio(ctx->seq.tracks.size());
+  resetTrackGains();
+  publishClock();
+  beginSong();
   player->setState(State::PLAYING);
 }
 
@@ -60,23 +120,39 @@ PlayerThread::~PlayerThread()
 
 void PlayerThread::run()
 {
+  // Export and GUI work must not delay the blocks the device is waiting for.
+  ThreadPriority::raiseToRealtime();
+  if (player->mixerCpu >= 0) {
+    ThreadPriority::pinToCpu(player->mixerCpu);
+  }
   try {
-    runStream();
-    // reset song state after it has finished
-    prepare(ctx->seq.GetSongHeaderPos());
+    // The stream keeps running between songs, so starting the next one
+    // doesn't have to wait for the device.
+    while (true) {
+      runStream();
+      stopSong();
+      if (!idle()) {
+        break;
+      }
+      resume();
+    }
   } catch (std::exception& e) {
     Debug::print("FATAL ERROR on streaming thread: %s", e.what());
     emit player->playbackError(e.what());
+    // stopSong() won't get to it, and the GUI waits for the recorder
+    stopRecording(false);
   }
-  Pa_StopStream(player->audioStream);
+  stopOutput();
   player->vuState.reset();
   // flush buffer
-  player->rBuf.Clear();
-  player->playerState = State::TERMINATED;
+  player->rBuf->Clear();
+  ThreadPriority::leaveRealtime();
+  player->acknowledgeState(State::TERMINATED);
 }
 
 void PlayerThread::runStream()
 {
+  AllocationAudit::reset();
   while (true) {
     switch (player->playerState) {
       case State::SHUTDOWN:
@@ -85,71 +161,645 @@ void PlayerThread::runStream()
       case State::RESTART:
         restart();
         [[fallthrough]];
-      case State::PLAYING:
-        if (process()) {
-          player->setState(State::SHUTDOWN);
+      case State::PLAYING: {
+        bool ended = false;
+        {
+          AllocationAudit::Scope audit;
+          applyCommands(false);
+          if (fade) {
+            crossfade();
+          } else if (replay) {
+            ended = replayBlock();
+            if (catchingUp && !ended) {
+              catchUp();
+            }
+          } else {
+            ended = process();
+          }
+        }
+        if (fade && fade->isDone() && !fade->front()) {
+          finishCrossfade();
+        } else if (!fade && !ended && ctx->reader.EndReached()) {
+          beginCrossfade();
+        }
+        if (ended) {
+          stopRecording(true);
+        }
+        if (ended && !advance()) {
           return;
         }
         break;
-      case State::PAUSED:
-        player->rBuf.Put(silence.data(), silence.size());
+      }
+      case State::PAUSED: {
+        AllocationAudit::Scope audit;
+        if (applyCommands(true)) {
+          // nothing else publishes while paused
+          player->snapshots.writeBuffer().capture(ctx, &player->vuState);
+          player->snapshots.publish();
+        }
+        if (replay && catchingUp) {
+          catchUp();
+        }
+        waitForOutput();
+        output(silence);
+        publishClock();
         break;
+      }
       default:
         throw Xcept("Internal PlayerInterface error: %d", (int)player->playerState.load());
     }
   }
 }
 
+void PlayerThread::stopSong()
+{
+  AllocationAudit::report("mixer thread");
+  stopRecording(false);
+  replay.reset();
+  // Stopping during a crossfade lands on the incoming song, which is what
+  // the GUI expects once the mixer has taken it.
+  if (fade) {
+    fade->cancel();
+    finishCrossfade();
+  } else if (heldCtx) {
+    switchTo(heldCtx);
+    heldCtx = nullptr;
+  }
+  // reset song state after it has finished
+  prepare(ctx->seq.GetSongHeaderPos());
+  player->vuState.reset();
+  player->snapshots.writeBuffer().capture(ctx, &player->vuState);
+  player->snapshots.publish();
+  // From here on the GUI owns the contexts and the command queue until it
+  // sets a playing state again.
+  player->acknowledgeState(State::TERMINATED);
+  QMetaObject::invokeMethod(player, "playbackDone", Qt::QueuedConnection);
+}
+
+bool PlayerThread::idle()
+{
+  while (!player->closingEngine) {
+    State state = player->playerState;
+    if (state == State::RESTART || state == State::PLAYING) {
+      return true;
+    }
+    waitForOutput();
+    output(silence);
+  }
+  return false;
+}
+
+void PlayerThread::resume()
+{
+  // the GUI may have selected another song or advanced to the queued one
+  ctx = player->ctx.get();
+  resizeTrackAudio(ctx->seq.tracks.size());
+  resetTrackGains();
+  fastForward = player->speed >= fastForwardSpeed;
+  publishClock();
+  beginSong();
+}
+
+// Picks up what the GUI prepared for the song about to start.
+void PlayerThread::beginSong()
+{
+  replay = player->replayEntry;
+  replayFrame = 0;
+  caughtUpFrame = 0;
+  catchingUp = false;
+  recording = player->recorder.get();
+  recordStart = blockFrame;
+}
+
+bool PlayerThread::replayBlock()
+{
+  prepareBuffers();
+  std::size_t frames = std::min(samplesPerBuffer, replay->frames() - replayFrame);
+  VUState& vu = player->vuState;
+  bool measureMaster = vu.masterVisible.load(std::memory_order_relaxed);
+  mixTrack(replay->data() + replayFrame, masterAudio.data(), frames, true, nullptr, measureMaster ? &vu.masterLoudness : nullptr);
+  replayFrame += frames;
+  // there are no separate tracks to measure
+  for (LevelMeter& meter : vu.loudness) {
+    meter.reset();
+  }
+  if (measureMaster) {
+    vu.masterLoudness.addSilence(samplesPerBuffer - frames);
+  } else {
+    vu.masterLoudness.reset();
+  }
+  outputBuffers();
+  return replayFrame >= replay->frames();
+}
+
+// Commands need the live engine, which first has to render silently up to
+// where the cached audio has got to. That happens a few blocks at a time
+// while the cache keeps playing, so it gains catchUpBlocks - 1 blocks on the
+// replay per block. Once it has caught up, playback continues live and the
+// commands waiting in the queue are applied.
+void PlayerThread::catchUp()
+{
+  bool ended = false;
+  skipping = true;
+  for (std::size_t i = 0; i < catchUpBlocks && caughtUpFrame < replayFrame && !ended; i++) {
+    ended = process();
+    caughtUpFrame += samplesPerBuffer;
+  }
+  skipping = false;
+  if (ended || caughtUpFrame >= replayFrame) {
+    replay.reset();
+    catchingUp = false;
+  }
+}
+
+void PlayerThread::stopRecording(bool complete)
+{
+  if (recording) {
+    recording->finish(complete);
+    recording = nullptr;
+  }
+}
+
+bool PlayerThread::advance()
+{
+  // The GUI thread initializes the next song on a second context. Switching
+  // to it here continues playback at the next block without stopping the
+  // stream or draining the ring buffer.
+  PlayerContext* next = heldCtx ? heldCtx : player->queuedCtx.exchange(nullptr);
+  heldCtx = nullptr;
+  if (!next) {
+    return false;
+  }
+  switchTo(next);
+  return true;
+}
+
+void PlayerThread::switchTo(PlayerContext* next)
+{
+  // the GUI didn't prepare a replay or recording for the new song
+  stopRecording(false);
+  replay.reset();
+  ctx = next;
+  // the speed may have changed since the GUI prepared the context
+  ctx->reader.SetSpeedFactor(player->speed);
+  resizeTrackAudio(ctx->seq.tracks.size());
+  resetTrackGains();
+  player->vuState.setTrackCount(int(ctx->seq.tracks.size()));
+  QMetaObject::invokeMethod(player, "advanceSong", Qt::QueuedConnection);
+}
+
+void PlayerThread::beginCrossfade()
+{
+  // The current song has played its last loop and is fading out on its own.
+  if (heldCtx || !player->queuedFade.load()) {
+    return;
+  }
+  PlayerContext* next = player->queuedCtx.exchange(nullptr);
+  if (!next) {
+    return;
+  }
+  // The GUI can't replace the helper once the context has been taken, so
+  // this load is consistent with next.
+  CrossfadeThread* helper = player->queuedFade.load();
+  if (!helper) {
+    // crossfading was turned off after the first check
+    heldCtx = next;
+    return;
+  }
+  // the faded tail isn't what the song sounds like on its own
+  stopRecording(false);
+  fade = helper;
+  fadeCtx = next;
+  // before the helper starts rendering it
+  fadeCtx->reader.SetSpeedFactor(player->speed);
+  fadeBlock = 0;
+  fadeBlocks = std::max<std::size_t>(1, std::size_t(helper->seconds() * ctx->mixer.GetSampleRate() / samplesPerBuffer));
+  fadeOutEnded = false;
+  fade->begin();
+}
+
+void PlayerThread::crossfade()
+{
+  if (fadeBlock >= fadeBlocks) {
+    // The incoming song has fully taken over. Play out what the helper has
+    // already rendered; runStream() switches to its context afterwards.
+    fade->cancel();
+    if (!fade->front()) {
+      // The helper is still finishing its last block. Yielding isn't enough
+      // at real-time priority if both threads share a CPU.
+      QThread::usleep(200);
+      return;
+    }
+  } else if (!fadeOutEnded) {
+    fadeOutEnded = process();
+    return;
+  }
+  prepareBuffers();
+  outputBuffers();
+}
+
+void PlayerThread::mixCrossfade()
+{
+  static constexpr double halfPi = 1.5707963267948966;
+  const sample* in = fade->front();
+  if (!in && fade->isDone() && fadeBlock < fadeBlocks) {
+    // the incoming song ended before the crossfade did
+    fadeBlock = fadeBlocks;
+  }
+
+  // equal-power gains at both ends of the block, interpolated in between
+  double x0 = std::min(1.0, double(fadeBlock) / fadeBlocks);
+  double x1 = in ? std::min(1.0, double(fadeBlock + 1) / fadeBlocks) : x0;
+  float out0 = std::cos(x0 * halfPi), out1 = std::cos(x1 * halfPi);
+  float in0 = std::sin(x0 * halfPi), in1 = std::sin(x1 * halfPi);
+  float step = 1.0f / samplesPerBuffer;
+  for (std::size_t i = 0; i < samplesPerBuffer; i++) {
+    float t = i * step;
+    float gainOut = out0 + (out1 - out0) * t;
+    masterAudio[i].left *= gainOut;
+    masterAudio[i].right *= gainOut;
+    if (in) {
+      float gainIn = in0 + (in1 - in0) * t;
+      masterAudio[i].left += in[i].left * gainIn;
+      masterAudio[i].right += in[i].right * gainIn;
+    }
+  }
+  if (in) {
+    // if the helper is running late, the fade holds its position instead
+    fade->pop();
+    fadeBlock++;
+  }
+}
+
+void PlayerThread::finishCrossfade()
+{
+  // The helper has stopped, so its context continues on this thread exactly
+  // where the last queued block left off.
+  fade->wait();
+  fade = nullptr;
+  switchTo(fadeCtx);
+  fadeCtx = nullptr;
+}
+
 void PlayerThread::restart()
 {
+  // a crossfade in progress completes early, restarting the incoming song
+  if (fade) {
+    fade->cancel();
+    finishCrossfade();
+  }
   prepare(ctx->seq.GetSongHeaderPos());
+  resetTrackGains();
+  // a restart right after the song was picked up keeps its recording
+  if (blockFrame != recordStart) {
+    stopRecording(false);
+  }
+  replayFrame = 0;
+  caughtUpFrame = 0;
   player->setState(State::PLAYING);
 }
 
+bool PlayerThread::applyCommands(bool immediate)
+{
+  // Commands due in this block are applied at their sample offset. While
+  // paused there is nothing to line up with, so everything applies at once.
+  std::uint64_t blockEnd = blockFrame + samplesPerBuffer;
+  bool applied = false;
+  while (const MixerCommand* front = player->commands.front()) {
+    if (!immediate && front->frame >= blockEnd) {
+      break;
+    }
+    if (replay) {
+      // the commands wait for the engine to catch up with the cached audio
+      catchingUp = true;
+      break;
+    }
+    MixerCommand command = *front;
+    player->commands.pop();
+    applied = true;
+    // the song no longer sounds like its cached version
+    stopRecording(false);
+
+    std::size_t offset = immediate || command.frame <= blockFrame ? 0 : command.frame - blockFrame;
+    switch (command.type) {
+      case MixerCommand::Mute:
+        setTrackMute(command.track, command.on, offset, immediate);
+        break;
+      case MixerCommand::Solo:
+        for (int i = 0; i < int(trackAudio.size()); i++) {
+          setTrackMute(i, command.on && i != command.track, offset, immediate);
+        }
+        break;
+      case MixerCommand::Speed: {
+        // Dragging the slider queues many of these, and the engine only
+        // changes tempo between frames, so only the last one due in this
+        // block is applied.
+        const MixerCommand* next = player->commands.front();
+        if (next && next->type == MixerCommand::Speed && (immediate || next->frame < blockEnd)) {
+          break;
+        }
+        ctx->reader.SetSpeedFactor(command.speed);
+        fastForward = command.speed >= fastForwardSpeed;
+        break;
+      }
+    }
+  }
+  return applied;
+}
+
+void PlayerThread::setTrackMute(int track, bool mute, std::size_t offset, bool immediate)
+{
+  if (track < 0 || track >= int(trackAudio.size()) || track >= int(maxTracks)) {
+    return;
+  }
+  ctx->seq.tracks[track].muted = mute;
+  TrackGain& g = gains[track];
+  float target = mute ? 0.0f : 1.0f;
+  if (immediate) {
+    g.gain = g.target = target;
+    return;
+  }
+  if (g.target != target) {
+    g.target = target;
+    g.step = (target > g.gain ? 1.0f : -1.0f) / rampFrames;
+    g.start = offset;
+  }
+}
+
+void PlayerThread::resetTrackGains()
+{
+  for (std::size_t i = 0; i < maxTracks; i++) {
+    bool muted = i < trackAudio.size() && ctx->seq.tracks[i].muted;
+    gains[i] = TrackGain{ muted ? 0.0f : 1.0f, muted ? 0.0f : 1.0f, 0.0f, 0 };
+  }
+}
+
+void PlayerThread::publishClock()
+{
+  MixerClock& clock = player->mixerClock.writeBuffer();
+  clock.frame = blockFrame;
+  clock.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  player->mixerClock.publish();
+}
+
 void PlayerThread::prepareBuffers()
 {
+  if (skipping) {
+    return;
+  }
+  waitForOutput();
   fill(masterAudio.begin(), masterAudio.end(), sample{0.0f, 0.0f});
 }
 
-void PlayerThread::processTrack(std::size_t index, std::vector<sample>& samples, bool mute)
+void PlayerThread::processTrack(std::size_t index, std::vector<sample>& samples, bool)
 {
-  player->vuState.loudness[index].CalcLoudness(samples.data(), samplesPerBuffer);
-  if (mute) {
+  if (skipping) {
     return;
   }
-
-  for (size_t j = 0; j < samplesPerBuffer; j++) {
-    masterAudio[j].left += samples[j].left;
-    masterAudio[j].right += samples[j].right;
+  VUState& vu = player->vuState;
+  bool measureTrack = !fastForward && (vu.visibleTracks.load(std::memory_order_relaxed) & (1U << index));
+  // The master is complete once the last track has been added to it, so its
+  // level is measured in the same pass.
+  bool measureMaster = index + 1 == trackAudio.size() && vu.masterVisible.load(std::memory_order_relaxed);
+  LevelMeter* trackMeter = measureTrack ? &vu.loudness[index] : nullptr;
+  LevelMeter* masterMeter = measureMaster ? &vu.masterLoudness : nullptr;
+  TrackGain& g = gains[index < maxTracks ? index : 0];
+  if (index >= maxTracks || g.gain == g.target) {
+    bool mix = index >= maxTracks || g.gain > 0.0f;
+    mixTrack(samples.data(), masterAudio.data(), samplesPerBuffer, mix, trackMeter, masterMeter);
+    outputTrack(index, mix ? samples.data() : nullptr);
+  } else {
+    // Ramping: meter the track as it is, then mix a faded copy. The ramp
+    // starts at the command's sample offset and may continue into the
+    // next block.
+    mixTrack(samples.data(), masterAudio.data(), samplesPerBuffer, false, trackMeter, nullptr);
+    for (std::size_t i = 0; i < samplesPerBuffer; i++) {
+      if (i >= g.start && g.gain != g.target) {
+        g.gain += g.step;
+        if ((g.step > 0 && g.gain > g.target) || (g.step < 0 && g.gain < g.target)) {
+          g.gain = g.target;
+        }
+      }
+      rampAudio[i].left = samples[i].left * g.gain;
+      rampAudio[i].right = samples[i].right * g.gain;
+    }
+    g.start = 0;
+    mixTrack(rampAudio.data(), masterAudio.data(), samplesPerBuffer, true, nullptr, masterMeter);
+    outputTrack(index, rampAudio.data());
+  }
+  if (!measureTrack) {
+    // start from silence instead of a stale level when it becomes visible again
+    vu.loudness[index].reset();
+  }
+  if (!measureMaster && index + 1 == trackAudio.size()) {
+    vu.masterLoudness.reset();
   }
 }
 
 void PlayerThread::outputBuffers()
 {
-  player->rBuf.Put(masterAudio.data(), masterAudio.size());
-  player->vuState.masterLoudness.CalcLoudness(masterAudio.data(), samplesPerBuffer);
-  player->vuState.update();
+  if (skipping) {
+    return;
+  }
+  if (fade) {
+    mixCrossfade();
+  }
+  if (recording && !recording->push(masterAudio.data())) {
+    // the recorder fell behind
+    stopRecording(false);
+  }
+  output(masterAudio);
+  blockFrame += samplesPerBuffer;
+  publishClock();
+  if (trackAudio.empty()) {
+    player->vuState.masterLoudness.addSilence(samplesPerBuffer);
+  }
+  player->snapshots.writeBuffer().capture(ctx, &player->vuState);
+  player->snapshots.publish();
 }
 
-static GameConfig& cfg() {
-  return ConfigManager::Instance().GetCfg();
+void PlayerThread::startOutput()
+{
+#ifdef HAVE_JACK
+  // the JACK client is already running
+  if (jack) {
+    return;
+  }
+#endif
+  PaError err = Pa_StartStream(player->audioStream);
+  if (err != paNoError) {
+    throw Xcept("Pa_StartStream(): unable to start stream: %s", Pa_GetErrorText(err));
+  }
 }
 
-ExportThread::ExportThread(Player* player)
+void PlayerThread::stopOutput()
+{
+#ifdef HAVE_JACK
+  if (jack) {
+    return;
+  }
+#endif
+  Pa_StopStream(player->audioStream);
+}
+
+// With JACK the ring buffers don't block, so the mixer waits here before
+// writing a block to any of the ports.
+void PlayerThread::waitForOutput()
+{
+#ifdef HAVE_JACK
+  if (jack) {
+    jack->waitForSpace();
+  }
+#endif
+}
+
+void PlayerThread::outputTrack(std::size_t index, const sample* block)
+{
+#ifdef HAVE_JACK
+  if (jack && index < maxTracks) {
+    jack->writeTrack(index, block);
+    jackTracks |= 1U << index;
+  }
+#else
+  (void)index;
+  (void)block;
+#endif
+}
+
+void PlayerThread::output(std::vector<sample>& block)
+{
+#ifdef HAVE_JACK
+  if (jack) {
+    // every port advances by one block so the tracks stay aligned with the
+    // master; ports without a track this block get silence
+    for (std::size_t i = 0; i < maxTracks; i++) {
+      if (!(jackTracks & (1U << i))) {
+        jack->writeTrack(i, nullptr);
+      }
+    }
+    jackTracks = 0;
+    jack->writeMaster(block.data());
+    return;
+  }
+#endif
+  if (resampler.isActive()) {
+    std::size_t frames = resampler.process(block.data(), block.size(), outputAudio.data());
+    player->rBuf->Put(outputAudio.data(), frames);
+  } else {
+    player->rBuf->Put(block.data(), block.size());
+  }
+}
+
+CrossfadeThread::CrossfadeThread(Player* player, PlayerContext* ctx, double seconds)
+: AudioThread(player, "crossfade thread", ctx),
+  queue(16, samplesPerBuffer),
+  freeBlocks(int(queue.blocks())),
+  stopping(false),
+  done(false),
+  block(nullptr),
+  fadeSeconds(seconds)
+{
+  resizeTrackAudio(ctx->seq.tracks.size());
+}
+
+CrossfadeThread::~CrossfadeThread()
+{
+  cancel();
+  wait();
+}
+
+void CrossfadeThread::begin()
+{
+  started.release();
+}
+
+void CrossfadeThread::cancel()
+{
+  stopping = true;
+  started.release();
+  freeBlocks.release();
+}
+
+const sample* CrossfadeThread::front() const
+{
+  return queue.readSlot();
+}
+
+void CrossfadeThread::pop()
+{
+  queue.pop();
+  freeBlocks.release();
+}
+
+bool CrossfadeThread::isDone() const
+{
+  return done;
+}
+
+void CrossfadeThread::run()
+{
+  started.acquire();
+  try {
+    while (!stopping) {
+      freeBlocks.acquire();
+      if (stopping || process()) {
+        break;
+      }
+    }
+  } catch (std::exception& e) {
+    Debug::print("Error on crossfade thread: %s", e.what());
+  }
+  done = true;
+}
+
+void CrossfadeThread::prepareBuffers()
+{
+  block = queue.writeSlot();
+  std::fill(block, block + samplesPerBuffer, sample{0.0f, 0.0f});
+}
+
+void CrossfadeThread::processTrack(std::size_t, std::vector<sample>& samples, bool mute)
+{
+  mixTrack(samples.data(), block, samplesPerBuffer, !mute, nullptr, nullptr);
+}
+
+void CrossfadeThread::outputBuffers()
+{
+  queue.push();
+}
+
+// Items queued together share this thread's context, so they are all
+// captured from the same configuration.
+ExportThread::ExportThread(Player* player, const ExportConfig& config)
 : AudioThread(player, "export thread", new PlayerContext(
-    ConfigManager::Instance().GetMaxLoopsPlaylist(),
-    cfg().GetTrackLimit(),
-    EnginePars(
-      cfg().GetPCMVol(),
-      cfg().GetEngineRev(),
-      cfg().GetEngineFreq()
-    )
+    config.maxLoops,
+    config.trackLimit,
+    config.enginePars()
   )),
   masterLeft(samplesPerBuffer, 0),
   masterRight(samplesPerBuffer, 0),
-  silence(samplesPerBuffer, 0)
+  silence(samplesPerBuffer, 0),
+  outputRate(ctx->mixer.GetSampleRate()),
+  exportTracks(false),
+  measurePeak(false),
+  blockPeak(0.0f),
+  jumpedBack(false),
+  loopCursor(0),
+  loopMisses(0)
 {
   player->abortExport = false;
+
+  int exportRate = config.sampleRate;
+  if (exportRate > 0 && exportRate != ctx->mixer.GetSampleRate()) {
+    outputRate = exportRate;
+    OutputResampler sizing;
+    sizing.setRates(ctx->mixer.GetSampleRate(), outputRate, samplesPerBuffer);
+    std::size_t maxFrames = std::max(sizing.maxOutputFrames(samplesPerBuffer), samplesPerBuffer);
+    masterLeft.resize(maxFrames, 0);
+    masterRight.resize(maxFrames, 0);
+    masterAudio.resize(samplesPerBuffer, sample{0.0f, 0.0f});
+    resampled.resize(maxFrames, sample{0.0f, 0.0f});
+  }
 }
 
 ExportThread::~ExportThread()
@@ -161,15 +811,30 @@ ExportThread::~ExportThread()
 
 void ExportThread::prepareBuffers()
 {
+  blockPeak = 0.0f;
   if (!exportTracks) {
     std::fill(masterLeft.begin(), masterLeft.end(), 0);
     std::fill(masterRight.begin(), masterRight.end(), 0);
+    std::fill(masterAudio.begin(), masterAudio.end(), sample{0.0f, 0.0f});
   }
 }
 
 void ExportThread::processTrack(std::size_t index, std::vector<sample>& samples, bool)
 {
-  if (exportTracks) {
+  if (measurePeak && exportTracks) {
+    measure(samples.data(), samplesPerBuffer);
+  }
+  if (!resamplers.empty()) {
+    // mix in float and convert once the master is at the output rate
+    if (exportTracks) {
+      writeResampled(riffs[index].get(), resamplers[index].process(samples.data(), samplesPerBuffer, resampled.data()));
+    } else {
+      for (size_t j = 0; j < samplesPerBuffer; j++) {
+        masterAudio[j].left += samples[j].left;
+        masterAudio[j].right += samples[j].right;
+      }
+    }
+  } else if (exportTracks) {
     for (size_t j = 0; j < samplesPerBuffer; j++) {
       masterLeft[j] = samples[j].left * 32767;
       masterRight[j] = samples[j].right * 32767;
@@ -185,11 +850,50 @@ void ExportThread::processTrack(std::size_t index, std::vector<sample>& samples,
 
 void ExportThread::outputBuffers()
 {
-  if (!exportTracks) {
+  if (exportTracks) {
+    return;
+  }
+  if (!resamplers.empty()) {
+    if (measurePeak) {
+      measure(masterAudio.data(), samplesPerBuffer);
+    }
+    writeResampled(riff.get(), resamplers[0].process(masterAudio.data(), samplesPerBuffer, resampled.data()));
+  } else {
+    if (measurePeak) {
+      for (size_t j = 0; j < samplesPerBuffer; j++) {
+        blockPeak = std::max({ blockPeak, std::fabs(masterLeft[j] / 32767.0f), std::fabs(masterRight[j] / 32767.0f) });
+      }
+    }
     riff->write(masterLeft, masterRight);
   }
 }
 
+void ExportThread::measure(const sample* samples, std::size_t count)
+{
+  for (std::size_t j = 0; j < count; j++) {
+    blockPeak = std::max({ blockPeak, std::fabs(samples[j].left), std::fabs(samples[j].right) });
+  }
+}
+
+bool ExportThread::notesPlaying() const
+{
+  for (const auto& track : ctx->seq.tracks) {
+    if (track.activeNotes.any()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ExportThread::writeResampled(RiffWriter* riff, std::size_t frames)
+{
+  for (size_t j = 0; j < frames; j++) {
+    masterLeft[j] = resampled[j].left * 32767;
+    masterRight[j] = resampled[j].right * 32767;
+  }
+  riff->write(masterLeft.data(), masterRight.data(), frames);
+}
+
 void ExportThread::pad(RiffWriter* riff, std::uint32_t samples) const
 {
   while (samples > samplesPerBuffer) {
@@ -197,20 +901,169 @@ void ExportThread::pad(RiffWriter* riff, std::uint32_t samples) const
     samples -= samplesPerBuffer;
   }
   if (samples > 0) {
-    std::vector<std::int16_t> shortSilence(samples, 0);
-    riff->write(shortSilence, shortSilence);
+    riff->write(silence.data(), silence.data(), samples);
+  }
+}
+
+std::vector<RiffWriter*> ExportThread::outputFiles() const
+{
+  std::vector<RiffWriter*> files;
+  if (exportTracks) {
+    for (const auto& riff : riffs) {
+      files.push_back(riff.get());
+    }
+  } else if (riff) {
+    files.push_back(riff.get());
+  }
+  return files;
+}
+
+// Where every track is and where its pattern calls return to. The wait
+// counters are left out: ticks fall at different offsets within a block on
+// each pass when the loop length isn't a whole number of blocks.
+void ExportThread::sequenceState(std::vector<std::size_t>& key) const
+{
+  key.clear();
+  for (const auto& track : ctx->seq.tracks) {
+    key.push_back(track.pos);
+    key.push_back(track.patternLevel);
+    for (int level = 0; level < int(track.patternLevel); level++) {
+      key.push_back(track.returnPos[level]);
+    }
+  }
+}
+
+// Adds the state after the block that started at frame to the history,
+// unless no track has moved. Returns whether it was added.
+bool ExportThread::recordState(std::uint32_t frame)
+{
+  sequenceState(stateKey);
+  if (!history.empty() && history.back().key == stateKey) {
+    return false;
+  }
+  history.push_back(SequenceState{ frame, stateKey });
+  jumpedBack = false;
+  for (std::size_t i = 0; i < trackPositions.size(); i++) {
+    std::size_t pos = ctx->seq.tracks[i].pos;
+    jumpedBack = jumpedBack || pos < trackPositions[i];
+    trackPositions[i] = pos;
+  }
+  return true;
+}
+
+// The sequence has come around once a jump backwards leaves it in a state it
+// was in before, pattern calls included, so the first jump of the loop is
+// enough. Returns the estimated length of the loop in output frames.
+std::uint32_t ExportThread::detectLoop()
+{
+  if (!jumpedBack || history.size() < 2) {
+    return 0;
+  }
+  const SequenceState& now = history.back();
+  for (std::size_t i = history.size() - 1; i-- > 0;) {
+    if (history[i].key == now.key) {
+      loopCursor = i;
+      loopMisses = 0;
+      return now.frame - history[i].frame;
+    }
+  }
+  return 0;
+}
+
+// Whether the state just recorded continues the earlier pass. A block can
+// hold two ticks on one pass and one on the other, so either pass may skip a
+// state the other recorded.
+bool ExportThread::followsLoop()
+{
+  const std::vector<std::size_t>& key = history.back().key;
+  for (std::size_t next = loopCursor + 1; next <= loopCursor + 2 && next + 1 < history.size(); next++) {
+    if (history[next].key == key) {
+      loopCursor = next;
+      loopMisses = 0;
+      return true;
+    }
+  }
+  return ++loopMisses < 2;
+}
+
+// Jumps are only seen at block boundaries, so the exact length is the lag
+// near the estimate at which the audio before end best matches the audio one
+// loop earlier. repeats is cleared if even that lag doesn't match closely;
+// the noise channel doesn't come around with the sequence, so it needn't be
+// exact.
+std::uint32_t ExportThread::measureLoop(std::uint32_t end, std::uint32_t estimate, bool* repeats)
+{
+  *repeats = true;
+  std::uint32_t radius = std::uint32_t(std::ceil(samplesPerBuffer * outputRate / ctx->mixer.GetSampleRate())) + 16;
+  std::uint32_t window = std::min(estimate / 2, std::uint32_t(outputRate / 4));
+  if (estimate <= radius || end < estimate + radius + window) {
+    return estimate;
+  }
+  std::uint32_t span = window + 2 * radius;
+  std::vector<double> difference(2 * radius + 1, 0.0);
+  double level = 0.0;
+  std::vector<std::int16_t> left(window), right(window), earlierLeft(span), earlierRight(span);
+  for (RiffWriter* file : outputFiles()) {
+    if (!file->read(end - window, window, left.data(), right.data()) ||
+        !file->read(end - window - estimate - radius, span, earlierLeft.data(), earlierRight.data())) {
+      return estimate;
+    }
+    for (std::uint32_t j = 0; j < window; j++) {
+      level += std::abs(left[j]) + std::abs(right[j]);
+    }
+    for (std::uint32_t k = 0; k <= 2 * radius; k++) {
+      double sum = 0.0;
+      for (std::uint32_t j = 0; j < window; j++) {
+        sum += std::abs(left[j] - earlierLeft[j + k]) + std::abs(right[j] - earlierRight[j + k]);
+      }
+      difference[k] += sum;
+    }
+  }
+  std::size_t best = std::min_element(difference.begin(), difference.end()) - difference.begin();
+  *repeats = difference[best] <= level * 0.05;
+  return estimate + radius - std::uint32_t(best);
+}
+
+void ExportThread::finishLoop(const ExportConfig& config, std::uint32_t length)
+{
+  std::vector<RiffWriter*> files = outputFiles();
+  std::uint32_t end = files[0]->frames();
+  Debug::print("Export: loop of %u frames ending at frame %u", length, end);
+  if (config.loopCopies > 0) {
+    std::uint32_t repeat = std::uint32_t(config.loopCopies - 1) * length;
+    std::uint32_t fade = std::uint32_t(config.loopFadeSeconds * outputRate);
+    for (RiffWriter* file : files) {
+      if (!file->appendLoop(end - length, length, repeat, 1.0f, 1.0f) ||
+          !file->appendLoop(end - length, length, fade, 1.0f, 0.0f)) {
+        throw Xcept("Unable to repeat the loop in the exported file");
+      }
+      pad(file, std::uint32_t(config.padSecondsEnd * outputRate));
+    }
+  } else {
+    for (RiffWriter* file : files) {
+      file->setLoop(end - length, end - 1);
+    }
   }
 }
 
 void ExportThread::run()
 {
-  std::uint32_t padStart = ConfigManager::Instance().GetPadSecondsStart() * ctx->mixer.GetSampleRate();
-  std::uint32_t padEnd = ConfigManager::Instance().GetPadSecondsEnd() * ctx->mixer.GetSampleRate();
+  ThreadPriority::lower();
+  bool resampling = outputRate != ctx->mixer.GetSampleRate();
   while (!player->exportQueue.isEmpty() && !player->abortExport) {
     auto item = player->exportQueue.takeFirst();
+    std::uint32_t padStart = item.config.padSecondsStart * outputRate;
+    std::uint32_t padEnd = item.config.padSecondsEnd * outputRate;
     exportTracks = item.splitTracks;
     try {
       prepare(item.trackAddr);
+      if (resampling) {
+        // one converter per output file, since each keeps its own history
+        resamplers.resize(exportTracks ? trackAudio.size() : 1);
+        for (auto& resampler : resamplers) {
+          resampler.setRates(ctx->mixer.GetSampleRate(), outputRate, samplesPerBuffer);
+        }
+      }
       if (exportTracks) {
         int numTracks = trackAudio.size();
         QDir dir(item.outputPath);
@@ -219,7 +1072,7 @@ void ExportThread::run()
         }
         riffs.clear();
         for (int i = 0; i < numTracks; i++) {
-          RiffWriter* riff = new RiffWriter(ctx->mixer.GetSampleRate(), true);
+          RiffWriter* riff = new RiffWriter(std::uint32_t(outputRate), true);
           riffs.emplace_back(riff);
           QString filename = dir.absoluteFilePath(QStringLiteral("%1.wav").arg(i));
           bool ok = riff->open(filename);
@@ -230,7 +1083,7 @@ void ExportThread::run()
           pad(riff, padStart);
         }
       } else {
-        riff.reset(new RiffWriter(ctx->mixer.GetSampleRate(), true));
+        riff.reset(new RiffWriter(std::uint32_t(outputRate), true));
         bool ok = riff->open(item.outputPath);
         if (!ok) {
           riff.reset();
@@ -239,22 +1092,117 @@ void ExportThread::run()
         pad(riff.get(), padStart);
       }
       emit player->exportStarted(item.outputPath);
+      std::vector<RiffWriter*> files = outputFiles();
+      bool findLoop = item.config.loopExport && !files.empty();
+      std::uint32_t loopEstimate = 0, loopLength = 0, stopFrame = 0;
+      bool looped = false;
+      trackPositions.assign(ctx->seq.tracks.size(), 0);
+      history.clear();
+      jumpedBack = false;
+      measurePeak = item.config.silenceSeconds > 0 && !files.empty();
+      std::size_t silenceLimit = std::max<std::size_t>(1, std::size_t(item.config.silenceSeconds * ctx->mixer.GetSampleRate()));
+      std::size_t silentFrames = 0;
+      std::uint32_t silenceStart = 0;
+      bool sounded = false, silenced = false;
+      double engineRate = ctx->mixer.GetSampleRate();
+      std::uint64_t renderedFrames = 0;
+      QElapsedTimer renderTime;
+      renderTime.start();
+      QString budgetError;
       while (!player->abortExport) {
+        std::uint32_t frame = findLoop ? files[0]->frames() : 0;
         if (process()) {
           break;
         }
+        renderedFrames += samplesPerBuffer;
+        qint64 elapsed = renderTime.elapsed();
+        ExportBudget::Stop stop = item.config.budget.check(renderedFrames, engineRate, elapsed);
+        if (stop == ExportBudget::Stop::AudioLimit) {
+          budgetError = QStringLiteral("%1: stopped after rendering %2 seconds of audio, the limit per song")
+            .arg(item.outputPath).arg(renderedFrames / engineRate, 0, 'f', 1);
+          break;
+        } else if (stop == ExportBudget::Stop::TimeLimit) {
+          budgetError = QStringLiteral("%1: stopped after %2 seconds of rendering (%3 seconds of audio), the limit per song")
+            .arg(item.outputPath).arg(elapsed / 1000.0, 0, 'f', 1).arg(renderedFrames / engineRate, 0, 'f', 1);
+          break;
+        }
+        if (measurePeak) {
+          if (blockPeak >= item.config.silenceLevel || notesPlaying()) {
+            sounded = true;
+            silentFrames = 0;
+          } else if (!sounded) {
+            // rests before the first note don't count
+          } else if (silentFrames == 0) {
+            // past whatever the resampler still held back of the last sound
+            silenceStart = files[0]->frames();
+            silentFrames = samplesPerBuffer;
+          } else {
+            silentFrames += samplesPerBuffer;
+          }
+          if (silentFrames >= silenceLimit) {
+            silenced = true;
+            break;
+          }
+        }
+        if (!findLoop) {
+          continue;
+        }
+        bool changed = recordState(frame);
+        if (!loopEstimate) {
+          if (changed) {
+            loopEstimate = detectLoop();
+            // give the notes held over from the previous pass time to fade
+            // before the loop that gets marked begins
+            stopFrame = frame + std::min(loopEstimate, std::uint32_t(2 * outputRate));
+          }
+          continue;
+        } else if (changed && !followsLoop()) {
+          // the same state with a different future, such as a track that
+          // jumped back on its own
+          loopEstimate = 0;
+          continue;
+        } else if (files[0]->frames() < stopFrame) {
+          continue;
+        }
+        bool repeats;
+        loopLength = measureLoop(files[0]->frames(), loopEstimate, &repeats);
+        if (repeats) {
+          looped = true;
+          break;
+        }
+        // keep going and export the song as it plays, without loop points
+        Debug::print("Export: %s doesn't repeat after %u frames", qPrintable(item.outputPath), loopEstimate);
+        findLoop = false;
       }
-      if (exportTracks) {
-        for (auto& riff : riffs) {
-          pad(riff.get(), padEnd);
-          riff->close();
+      if (looped) {
+        // no resampler flush: what follows the end is the loop, not silence
+        finishLoop(item.config, loopLength);
+      } else if (silenced) {
+        // cut the silence that ended the song back to the usual padding
+        Debug::print("Export: %s ended after %.1f seconds of silence", qPrintable(item.outputPath), item.config.silenceSeconds);
+        for (RiffWriter* file : files) {
+          if (!file->truncate(silenceStart)) {
+            throw Xcept("Unable to shorten exported file");
+          }
+          pad(file, padEnd);
         }
       } else {
-        pad(riff.get(), padEnd);
-        riff->close();
+        for (std::size_t i = 0; i < resamplers.size(); i++) {
+          writeResampled(files[i], resamplers[i].flush(resampled.data()));
+        }
+        for (RiffWriter* file : files) {
+          pad(file, padEnd);
+        }
+      }
+      for (RiffWriter* file : files) {
+        file->close();
       }
       if (player->abortExport) {
         break;
+      } else if (!budgetError.isEmpty()) {
+        // what was rendered is kept, but the song didn't finish
+        Debug::print("Export: %s", qPrintable(budgetError));
+        emit player->exportError(budgetError);
       } else {
         emit player->exportFinished(item.outputPath);
       }
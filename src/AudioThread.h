@@ -1,9 +1,13 @@
 #pragma once
 
 #include <QThread>
+#include <QSemaphore>
 #include <vector>
+#include <atomic>
 #include "Player.h"
 #include "Types.h"
+#include "BlockQueue.h"
+#include "OutputResampler.h"
 class RiffWriter;
 
 class AudioThread : public QThread
@@ -11,6 +15,9 @@ class AudioThread : public QThread
 public:
   using State = Player::State;
 
+  // worst case for song-track-limit, which ConfigManager clamps to 16
+  static constexpr std::size_t maxTracks = 16;
+
   ~AudioThread();
 
 protected:
@@ -18,6 +25,7 @@ protected:
 
   bool process();
   void prepare(quint32 addr);
+  void resizeTrackAudio(std::size_t numTracks);
   virtual void prepareBuffers() = 0;
   virtual void processTrack(std::size_t index, std::vector<sample>& samples, bool mute) = 0;
   virtual void outputBuffers() = 0;
@@ -26,8 +34,13 @@ protected:
   PlayerContext* ctx;
   std::size_t samplesPerBuffer;
   std::vector<std::vector<sample>> trackAudio;
+
+private:
+  std::vector<std::vector<sample>> spareAudio;
 };
 
+class CrossfadeThread;
+
 class PlayerThread : public AudioThread
 {
 public:
@@ -43,16 +56,105 @@ protected:
 
 private:
   void runStream();
+  void stopSong();
+  bool idle();
+  void resume();
+  void beginSong();
+  bool replayBlock();
+  void catchUp();
+  void stopRecording(bool complete);
+  bool advance();
+  void switchTo(PlayerContext* next);
   void restart();
   void play();
 
-  std::vector<sample> silence, masterAudio;
+  void startOutput();
+  void stopOutput();
+  void waitForOutput();
+  void outputTrack(std::size_t index, const sample* block);
+  void output(std::vector<sample>& block);
+  bool applyCommands(bool immediate);
+  void setTrackMute(int track, bool mute, std::size_t offset, bool immediate);
+  void resetTrackGains();
+  void publishClock();
+
+  void beginCrossfade();
+  void crossfade();
+  void mixCrossfade();
+  void finishCrossfade();
+
+  std::vector<sample> silence, masterAudio, rampAudio, outputAudio;
+  OutputResampler resampler;
+
+  // per-track gain, ramped over a few milliseconds when muting
+  struct TrackGain {
+    float gain, target, step;
+    std::size_t start;
+  };
+  TrackGain gains[maxTracks];
+  std::size_t rampFrames;
+  std::uint64_t blockFrame;
+  // skip work nobody can follow at high speeds
+  bool fastForward;
+
+  CrossfadeThread* fade;
+  PlayerContext* fadeCtx;
+  PlayerContext* heldCtx;
+  std::size_t fadeBlock, fadeBlocks;
+  bool fadeOutEnded;
+
+  // cached audio played instead of rendering, or a recorder being filled
+  std::shared_ptr<const RenderCache::Entry> replay;
+  std::size_t replayFrame;
+  RenderRecorder* recording;
+  std::uint64_t recordStart;
+  // the engine rendering without output to catch up with a replay
+  std::size_t caughtUpFrame;
+  bool catchingUp, skipping;
+
+#ifdef HAVE_JACK
+  JackOutput* jack;
+  // tracks sent to their own JACK ports in the current block
+  std::uint32_t jackTracks;
+#endif
+};
+
+// Renders the next song ahead of the mixer while two songs overlap. The mixer
+// thread consumes the rendered blocks from a lock-free queue.
+class CrossfadeThread : public AudioThread
+{
+public:
+  CrossfadeThread(Player* player, PlayerContext* ctx, double seconds);
+  ~CrossfadeThread();
+
+  double seconds() const { return fadeSeconds; }
+
+  // called from the mixer thread
+  void begin();
+  void cancel();
+  const sample* front() const;
+  void pop();
+  bool isDone() const;
+
+protected:
+  virtual void run() override;
+
+  virtual void prepareBuffers() override;
+  virtual void processTrack(std::size_t index, std::vector<sample>& samples, bool mute) override;
+  virtual void outputBuffers() override;
+
+private:
+  BlockQueue queue;
+  QSemaphore started, freeBlocks;
+  std::atomic<bool> stopping, done;
+  sample* block;
+  double fadeSeconds;
 };
 
 class ExportThread : public AudioThread
 {
 public:
-  ExportThread(Player* player);
+  ExportThread(Player* player, const ExportConfig& config);
   ~ExportThread();
 
 protected:
@@ -63,11 +165,45 @@ protected:
   virtual void outputBuffers() override;
 
 private:
+  // the sequencer state after a block, recorded when it changes
+  struct SequenceState {
+    std::uint32_t frame;
+    std::vector<std::size_t> key;
+  };
+
   void pad(RiffWriter* riff, std::uint32_t samples) const;
+  void measure(const sample* samples, std::size_t count);
+  bool notesPlaying() const;
+  void writeResampled(RiffWriter* riff, std::size_t frames);
+
+  std::vector<RiffWriter*> outputFiles() const;
+  void sequenceState(std::vector<std::size_t>& key) const;
+  bool recordState(std::uint32_t frame);
+  std::uint32_t detectLoop();
+  bool followsLoop();
+  std::uint32_t measureLoop(std::uint32_t end, std::uint32_t estimate, bool* repeats);
+  void finishLoop(const ExportConfig& config, std::uint32_t length);
 
   std::unique_ptr<RiffWriter> riff;
   std::vector<std::unique_ptr<RiffWriter>> riffs;
   std::vector<std::int16_t> masterLeft, masterRight, silence;
 
+  // only used when exporting at a rate other than the engine's
+  double outputRate;
+  std::vector<OutputResampler> resamplers;
+  std::vector<sample> masterAudio, resampled;
+
   bool exportTracks;
+
+  // loudest sample of the block, over the master or every track
+  bool measurePeak;
+  float blockPeak;
+
+  std::vector<std::size_t> trackPositions, stateKey;
+  std::vector<SequenceState> history;
+  bool jumpedBack;
+  // the entry of history the sequence is expected to follow after a
+  // suspected loop, and how many states in a row didn't match it
+  std::size_t loopCursor;
+  int loopMisses;
 };
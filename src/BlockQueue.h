@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include "Types.h"
+
+// Lock-free queue of fixed-size audio blocks between one producer thread and
+// one consumer thread. All storage is allocated up front. writeSlot() and
+// readSlot() return nullptr when the queue is full or empty; neither side
+// ever waits.
+class BlockQueue
+{
+public:
+  BlockQueue(std::size_t blocks, std::size_t blockSize)
+  : blockSize(blockSize), capacity(blocks + 1), storage(capacity * blockSize, sample{0.0f, 0.0f}), head(0), tail(0) {}
+
+  std::size_t blocks() const
+  {
+    return capacity - 1;
+  }
+
+  sample* writeSlot()
+  {
+    std::size_t t = tail.load(std::memory_order_relaxed);
+    if ((t + 1) % capacity == head.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &storage[t * blockSize];
+  }
+
+  void push()
+  {
+    tail.store((tail.load(std::memory_order_relaxed) + 1) % capacity, std::memory_order_release);
+  }
+
+  const sample* readSlot() const
+  {
+    std::size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &storage[h * blockSize];
+  }
+
+  void pop()
+  {
+    head.store((head.load(std::memory_order_relaxed) + 1) % capacity, std::memory_order_release);
+  }
+
+private:
+  std::size_t blockSize, capacity;
+  std::vector<sample> storage;
+  alignas(64) std::atomic<std::size_t> head;
+  alignas(64) std::atomic<std::size_t> tail;
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// A change requested by the GUI, applied by the mixer thread at the sample
+// given by frame, counted from the start of playback.
+struct MixerCommand
+{
+  enum Type {
+    Mute, Solo, Speed
+  };
+
+  Type type;
+  std::uint64_t frame;
+  int track;
+  bool on;
+  double speed;
+};
+
+// Where the mixer was at a given time, so the GUI can timestamp commands.
+struct MixerClock
+{
+  std::uint64_t frame;
+  std::int64_t nanoseconds;
+};
+
+// Lock-free queue of commands from one producer thread to one consumer
+// thread. Commands are stored in place, so neither side allocates.
+class CommandQueue
+{
+public:
+  CommandQueue() : head(0), tail(0) {}
+
+  bool push(const MixerCommand& command)
+  {
+    std::size_t t = tail.load(std::memory_order_relaxed);
+    std::size_t next = (t + 1) % capacity;
+    if (next == head.load(std::memory_order_acquire)) {
+      return false;
+    }
+    commands[t] = command;
+    tail.store(next, std::memory_order_release);
+    return true;
+  }
+
+  const MixerCommand* front() const
+  {
+    std::size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &commands[h];
+  }
+
+  void pop()
+  {
+    head.store((head.load(std::memory_order_relaxed) + 1) % capacity, std::memory_order_release);
+  }
+
+private:
+  static constexpr std::size_t capacity = 256;
+
+  MixerCommand commands[capacity];
+  alignas(64) std::atomic<std::size_t> head;
+  alignas(64) std::atomic<std::size_t> tail;
+};
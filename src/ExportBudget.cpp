@@ -0,0 +1,14 @@
+#include "ExportBudget.h"
+
+ExportBudget::Stop ExportBudget::check(std::uint64_t renderedFrames, double engineRate, std::int64_t elapsedMs) const
+{
+  std::uint64_t frameLimit = std::uint64_t(maxRenderSeconds * engineRate);
+  if (frameLimit && renderedFrames >= frameLimit) {
+    return Stop::AudioLimit;
+  }
+  std::int64_t timeLimit = std::int64_t(maxWallSeconds * 1000);
+  if (timeLimit && elapsedMs >= timeLimit) {
+    return Stop::TimeLimit;
+  }
+  return Stop::None;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+
+// Limits on one export item, in case its sequence never ends. 0 means no
+// limit. Kept free of Qt and the engine so it can be tested on its own.
+struct ExportBudget
+{
+  enum class Stop {
+    None, AudioLimit, TimeLimit
+  };
+
+  double maxRenderSeconds;
+  double maxWallSeconds;
+
+  // Whether rendering has to stop after renderedFrames at the engine's rate
+  // and elapsedMs of wall-clock time. The audio limit is checked first.
+  Stop check(std::uint64_t renderedFrames, double engineRate, std::int64_t elapsedMs) const;
+};
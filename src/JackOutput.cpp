@@ -0,0 +1,196 @@
+#include "JackOutput.h"
+#include "Xcept.h"
+#include "Debug.h"
+#include <algorithm>
+#include <cstdio>
+
+JackOutput::JackOutput(std::size_t numTracks, double engineRate, std::size_t blockFrames, std::size_t bufferFrames)
+: client(nullptr), blockFrames(blockFrames), aborted(false)
+{
+  jack_status_t status;
+  client = jack_client_open("agbplay", JackNoStartServer, &status);
+  if (!client) {
+    throw Xcept("jack_client_open(): unable to connect to JACK server (status 0x%x)", unsigned(status));
+  }
+  rate = jack_get_sample_rate(client);
+  try {
+    registerPorts(numTracks, engineRate, bufferFrames);
+  } catch (...) {
+    close();
+    throw;
+  }
+  Debug::print("JACK: connected at %g Hz with %d port pairs", rate, int(pairs.size()));
+}
+
+void JackOutput::registerPorts(std::size_t numTracks, double engineRate, std::size_t bufferFrames)
+{
+  // pair 0 is the master, followed by one pair per track
+  pairs.resize(numTracks + 1);
+  // bufferFrames is given at the engine rate; the rings hold output frames
+  // and always have room for a few resampled blocks
+  OutputResampler probe;
+  probe.setRates(engineRate, rate, blockFrames);
+  maxOutputFrames = probe.maxOutputFrames(blockFrames);
+  std::size_t ringFrames = std::max(std::size_t(bufferFrames * rate / engineRate), 4 * maxOutputFrames);
+  static const char* const channels[2] = { "left", "right" };
+  for (std::size_t i = 0; i < pairs.size(); i++) {
+    PortPair& pair = pairs[i];
+    pair.resampler.setRates(engineRate, rate, blockFrames);
+    for (int ch = 0; ch < 2; ch++) {
+      char name[32];
+      if (i == 0) {
+        std::snprintf(name, sizeof(name), "master_%s", channels[ch]);
+      } else {
+        std::snprintf(name, sizeof(name), "track%02d_%s", int(i - 1), channels[ch]);
+      }
+      pair.ports[ch] = jack_port_register(client, name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+      pair.rings[ch] = jack_ringbuffer_create(ringFrames * sizeof(float));
+      if (!pair.ports[ch] || !pair.rings[ch]) {
+        throw Xcept("JACK: unable to register port %s", name);
+      }
+    }
+  }
+  scratch.resize(std::max(maxOutputFrames, blockFrames), sample{0.0f, 0.0f});
+
+  jack_set_process_callback(client, processCallback, this);
+  if (jack_activate(client)) {
+    throw Xcept("jack_activate(): unable to activate client");
+  }
+}
+
+JackOutput::~JackOutput()
+{
+  close();
+}
+
+void JackOutput::close()
+{
+  if (client) {
+    jack_deactivate(client);
+    jack_client_close(client);
+    client = nullptr;
+  }
+  for (PortPair& pair : pairs) {
+    for (int ch = 0; ch < 2; ch++) {
+      if (pair.rings[ch]) {
+        jack_ringbuffer_free(pair.rings[ch]);
+        pair.rings[ch] = nullptr;
+      }
+    }
+  }
+}
+
+double JackOutput::sampleRate() const
+{
+  return rate;
+}
+
+std::size_t JackOutput::blockSize() const
+{
+  return blockFrames;
+}
+
+void JackOutput::waitForSpace()
+{
+  // Every port is written and read by the same amount, so the master ring
+  // paces all of them, the way Ringbuffer::Put paces the PortAudio path.
+  std::size_t needed = maxOutputFrames * sizeof(float);
+  QMutexLocker lock(&spaceLock);
+  while (!aborted && jack_ringbuffer_write_space(pairs[0].rings[0]) < needed) {
+    // The callback only signals if it gets the lock without waiting, so a
+    // wakeup can be missed; the timeout bounds that to a few milliseconds.
+    spaceFreed.wait(&spaceLock, 5);
+  }
+}
+
+void JackOutput::abort()
+{
+  QMutexLocker lock(&spaceLock);
+  aborted = true;
+  spaceFreed.wakeAll();
+}
+
+void JackOutput::writeTrack(std::size_t index, const sample* block)
+{
+  if (index + 1 < pairs.size()) {
+    write(pairs[index + 1], block);
+  }
+}
+
+void JackOutput::writeMaster(const sample* block)
+{
+  write(pairs[0], block);
+}
+
+void JackOutput::write(PortPair& pair, const sample* block)
+{
+  // a null block writes silence
+  std::size_t frames = blockFrames;
+  const sample* data = block;
+  if (!block) {
+    if (!pair.resampler.isActive()) {
+      writeSilence(pair, frames);
+      return;
+    }
+    // the resampler still has to run out the tail of the previous block
+    std::fill(scratch.begin(), scratch.begin() + blockFrames, sample{0.0f, 0.0f});
+    data = scratch.data();
+  }
+  if (pair.resampler.isActive()) {
+    frames = pair.resampler.process(data, blockFrames, scratch.data());
+    data = scratch.data();
+  }
+
+  // deinterleave straight into the ring buffers' free space
+  for (int ch = 0; ch < 2; ch++) {
+    jack_ringbuffer_data_t vec[2];
+    jack_ringbuffer_get_write_vector(pair.rings[ch], vec);
+    std::size_t written = 0;
+    for (int part = 0; part < 2 && written < frames; part++) {
+      float* out = reinterpret_cast<float*>(vec[part].buf);
+      std::size_t count = std::min(frames - written, vec[part].len / sizeof(float));
+      for (std::size_t i = 0; i < count; i++) {
+        out[i] = ch ? data[written + i].right : data[written + i].left;
+      }
+      written += count;
+    }
+    jack_ringbuffer_write_advance(pair.rings[ch], written * sizeof(float));
+  }
+}
+
+void JackOutput::writeSilence(PortPair& pair, std::size_t frames)
+{
+  for (int ch = 0; ch < 2; ch++) {
+    jack_ringbuffer_data_t vec[2];
+    jack_ringbuffer_get_write_vector(pair.rings[ch], vec);
+    std::size_t bytes = frames * sizeof(float);
+    std::size_t first = std::min(bytes, vec[0].len);
+    std::size_t second = std::min(bytes - first, vec[1].len);
+    std::fill(vec[0].buf, vec[0].buf + first, 0);
+    std::fill(vec[1].buf, vec[1].buf + second, 0);
+    jack_ringbuffer_write_advance(pair.rings[ch], first + second);
+  }
+}
+
+int JackOutput::processCallback(jack_nframes_t frames, void* self)
+{
+  return reinterpret_cast<JackOutput*>(self)->process(frames);
+}
+
+int JackOutput::process(jack_nframes_t frames)
+{
+  for (PortPair& pair : pairs) {
+    for (int ch = 0; ch < 2; ch++) {
+      float* out = reinterpret_cast<float*>(jack_port_get_buffer(pair.ports[ch], frames));
+      std::size_t got = jack_ringbuffer_read(pair.rings[ch], reinterpret_cast<char*>(out), frames * sizeof(float)) / sizeof(float);
+      // underrun or idle: pad with silence
+      std::fill(out + got, out + frames, 0.0f);
+    }
+  }
+  // never block the JACK thread on the mixer
+  if (spaceLock.tryLock()) {
+    spaceFreed.wakeOne();
+    spaceLock.unlock();
+  }
+  return 0;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <jack/jack.h>
+#include <jack/ringbuffer.h>
+#include <QMutex>
+#include <QWaitCondition>
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include "OutputResampler.h"
+#include "Types.h"
+
+// Native JACK client. Registers a stereo pair of output ports for the master
+// and for every track, so a DAW can record or process tracks separately.
+// The mixer thread writes each block into per-port lock-free ring buffers;
+// the JACK process callback copies them into the port buffers.
+class JackOutput
+{
+public:
+  // Throws if no JACK server is running.
+  JackOutput(std::size_t numTracks, double engineRate, std::size_t blockFrames, std::size_t bufferFrames);
+  ~JackOutput();
+
+  double sampleRate() const;
+  std::size_t blockSize() const;
+
+  // called from the mixer thread
+  void waitForSpace();
+  // makes waitForSpace() return from now on, for a mixer stuck on a server
+  // that stopped calling back
+  void abort();
+  void writeTrack(std::size_t index, const sample* block);
+  void writeMaster(const sample* block);
+
+private:
+  struct PortPair {
+    jack_port_t* ports[2] = {};
+    jack_ringbuffer_t* rings[2] = {};
+    OutputResampler resampler;
+  };
+
+  static int processCallback(jack_nframes_t frames, void* self);
+  int process(jack_nframes_t frames);
+  void write(PortPair& pair, const sample* block);
+  void writeSilence(PortPair& pair, std::size_t frames);
+  void registerPorts(std::size_t numTracks, double engineRate, std::size_t bufferFrames);
+  void close();
+
+  jack_client_t* client;
+  std::vector<PortPair> pairs;
+  std::vector<sample> scratch;
+  std::size_t blockFrames, maxOutputFrames;
+  double rate;
+  // signalled by the process callback after it has consumed a period
+  QMutex spaceLock;
+  QWaitCondition spaceFreed;
+  std::atomic<bool> aborted;
+};
@@ -0,0 +1,46 @@
+#include "LatencyProfile.h"
+#include "Constants.h"
+#include <QCoreApplication>
+#include <QSettings>
+
+LatencyProfile savedLatencyProfile()
+{
+  int profile = QSettings().value("latencyProfile", int(LatencyProfile::Balanced)).toInt();
+  if (profile < int(LatencyProfile::UltraLow) || profile > int(LatencyProfile::PowerSaving)) {
+    return LatencyProfile::Balanced;
+  }
+  return LatencyProfile(profile);
+}
+
+void saveLatencyProfile(LatencyProfile profile)
+{
+  QSettings().setValue("latencyProfile", int(profile));
+}
+
+LatencySettings latencySettings(LatencyProfile profile)
+{
+  switch (profile) {
+    case LatencyProfile::UltraLow:
+      // about 20ms of audio queued ahead of the device
+      return LatencySettings{ 128, false, std::size_t(STREAM_SAMPLERATE / 50) };
+    case LatencyProfile::PowerSaving:
+      // the device wakes the callback rarely and the mixer runs far ahead
+      return LatencySettings{ 2048, true, std::size_t(STREAM_SAMPLERATE / 5) };
+    case LatencyProfile::Balanced:
+    default:
+      return LatencySettings{ 0, false, std::size_t(STREAM_BUF_SIZE) };
+  }
+}
+
+QString latencyProfileName(LatencyProfile profile)
+{
+  switch (profile) {
+    case LatencyProfile::UltraLow:
+      return QCoreApplication::translate("LatencyProfile", "Ultra-low (for auditioning)");
+    case LatencyProfile::PowerSaving:
+      return QCoreApplication::translate("LatencyProfile", "Power saving");
+    case LatencyProfile::Balanced:
+    default:
+      return QCoreApplication::translate("LatencyProfile", "Balanced (Default)");
+  }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <QString>
+#include <cstddef>
+
+enum class LatencyProfile : int {
+  UltraLow, Balanced, PowerSaving
+};
+
+// How a latency profile sizes the output path. framesPerBuffer is passed to
+// Pa_OpenStream as-is, so 0 leaves the choice to the host API.
+struct LatencySettings
+{
+  unsigned long framesPerBuffer;
+  bool highLatency;
+  std::size_t ringBufferFrames;
+};
+
+LatencyProfile savedLatencyProfile();
+void saveLatencyProfile(LatencyProfile profile);
+LatencySettings latencySettings(LatencyProfile profile);
+QString latencyProfileName(LatencyProfile profile);
@@ -0,0 +1,108 @@
+#include "MixKernel.h"
+#include <cmath>
+
+LevelMeter::LevelMeter(float lowpassFreq)
+: lowpassFreq(lowpassFreq), coeff(1.0f), powLeft(0), powRight(0)
+{
+  // initializers only
+}
+
+void LevelMeter::setSampleRate(double sampleRate)
+{
+  coeff = float(1.0 - std::exp(-2.0 * M_PI * lowpassFreq / sampleRate));
+}
+
+void LevelMeter::reset()
+{
+  powLeft = 0;
+  powRight = 0;
+}
+
+void LevelMeter::addSilence(std::size_t samples)
+{
+  // closed form of running the filter over that many zeros
+  float decay = std::pow(1.0f - coeff, float(samples));
+  powLeft *= decay;
+  powRight *= decay;
+}
+
+void LevelMeter::getLevel(float& left, float& right) const
+{
+  left = std::sqrt(powLeft * 2.0f);
+  right = std::sqrt(powRight * 2.0f);
+}
+
+// The filter state lives in locals for the duration of the loop; the
+// recurrence costs one multiply-add per sample and channel.
+template <bool mix, bool measureTrack, bool measureMaster>
+static void mixTrackImpl(const sample* __restrict track, sample* __restrict master, std::size_t count, float trackCoeff, float* tp, float masterCoeff, float* mp)
+{
+  float tl = tp[0], tr = tp[1];
+  float ml = mp[0], mr = mp[1];
+  for (std::size_t i = 0; i < count; i++) {
+    sample s = track[i];
+    if (measureTrack) {
+      tl += trackCoeff * (s.left * s.left - tl);
+      tr += trackCoeff * (s.right * s.right - tr);
+    }
+    if (mix || measureMaster) {
+      sample m = master[i];
+      if (mix) {
+        m.left += s.left;
+        m.right += s.right;
+        master[i] = m;
+      }
+      if (measureMaster) {
+        ml += masterCoeff * (m.left * m.left - ml);
+        mr += masterCoeff * (m.right * m.right - mr);
+      }
+    }
+  }
+  tp[0] = tl;
+  tp[1] = tr;
+  mp[0] = ml;
+  mp[1] = mr;
+}
+
+using MixTrackFn = void (*)(const sample*, sample*, std::size_t, float, float*, float, float*);
+
+static const MixTrackFn mixTrackVariants[8] = {
+  mixTrackImpl<false, false, false>,
+  mixTrackImpl<false, false, true>,
+  mixTrackImpl<false, true, false>,
+  mixTrackImpl<false, true, true>,
+  mixTrackImpl<true, false, false>,
+  mixTrackImpl<true, false, true>,
+  mixTrackImpl<true, true, false>,
+  mixTrackImpl<true, true, true>,
+};
+
+void mixTrack(const sample* track, sample* master, std::size_t samples, bool mix, LevelMeter* trackMeter, LevelMeter* masterMeter)
+{
+  int variant = (mix ? 4 : 0) | (trackMeter ? 2 : 0) | (masterMeter ? 1 : 0);
+  if (!variant) {
+    return;
+  }
+  float tp[2] = { 0, 0 }, mp[2] = { 0, 0 };
+  if (trackMeter) {
+    tp[0] = trackMeter->powLeft;
+    tp[1] = trackMeter->powRight;
+  }
+  if (masterMeter) {
+    mp[0] = masterMeter->powLeft;
+    mp[1] = masterMeter->powRight;
+  }
+  mixTrackVariants[variant](
+    track, master, samples,
+    trackMeter ? trackMeter->coeff : 0.0f, tp,
+    masterMeter ? masterMeter->coeff : 0.0f, mp
+  );
+  if (trackMeter) {
+    trackMeter->powLeft = tp[0];
+    trackMeter->powRight = tp[1];
+  }
+  if (masterMeter) {
+    masterMeter->powLeft = mp[0];
+    masterMeter->powRight = mp[1];
+  }
+}
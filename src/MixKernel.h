@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include "Types.h"
+
+// Smoothed RMS level of a stereo signal: a one-pole lowpass over the squared
+// samples, run per sample so the decay time doesn't depend on the block size.
+class LevelMeter
+{
+public:
+  LevelMeter(float lowpassFreq = 5.0f);
+
+  void setSampleRate(double sampleRate);
+  void reset();
+  void addSilence(std::size_t samples);
+  void getLevel(float& left, float& right) const;
+
+private:
+  friend void mixTrack(const sample*, sample*, std::size_t, bool, LevelMeter*, LevelMeter*);
+
+  float lowpassFreq;
+  float coeff;
+  float powLeft, powRight;
+};
+
+// Single pass over one track buffer: adds it into master (if mix is set) and
+// feeds the track's samples to trackMeter. If masterMeter is not null, the
+// updated master samples are fed to it as well. Either measurement is skipped
+// when its meter is null.
+void mixTrack(const sample* track, sample* master, std::size_t samples, bool mix, LevelMeter* trackMeter, LevelMeter* masterMeter);
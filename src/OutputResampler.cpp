@@ -0,0 +1,115 @@
+#include "OutputResampler.h"
+#include <algorithm>
+#include <cmath>
+
+static double besselI0(double x)
+{
+  double sum = 1.0, term = 1.0;
+  for (int k = 1; k < 32; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+OutputResampler::OutputResampler()
+: step(1.0), position(0.0), active(false)
+{
+  // initializers only
+}
+
+void OutputResampler::setRates(double inputRate, double outputRate, std::size_t maxInputFrames)
+{
+  active = inputRate > 0 && outputRate > 0 && inputRate != outputRate;
+  step = active ? inputRate / outputRate : 1.0;
+  if (!active) {
+    kernel.clear();
+    buffer.clear();
+    return;
+  }
+
+  // When downsampling, the cutoff drops with the output rate to keep images
+  // out of the passband. The Kaiser window keeps stopband ripple near -80dB.
+  static constexpr double beta = 8.0;
+  double cutoff = std::min(1.0, outputRate / inputRate) * 0.95;
+  double norm = besselI0(beta);
+  kernel.assign(std::size_t(phases + 1) * taps, 0.0f);
+  for (int p = 0; p <= phases; p++) {
+    double frac = double(p) / phases;
+    float* row = &kernel[std::size_t(p) * taps];
+    double sum = 0;
+    for (int i = 0; i < taps; i++) {
+      double d = i - taps / 2 + 1 - frac;
+      double x = M_PI * cutoff * d;
+      double sinc = d == 0 ? 1.0 : std::sin(x) / x;
+      double w = d / (taps / 2);
+      double window = std::abs(w) >= 1.0 ? 0.0 : besselI0(beta * std::sqrt(1.0 - w * w)) / norm;
+      row[i] = float(cutoff * sinc * window);
+      sum += row[i];
+    }
+    // unity gain at DC for every phase
+    for (int i = 0; i < taps; i++) {
+      row[i] = float(row[i] / sum);
+    }
+  }
+
+  buffer.assign(taps + maxInputFrames, sample{0.0f, 0.0f});
+  reset();
+}
+
+bool OutputResampler::isActive() const
+{
+  return active;
+}
+
+void OutputResampler::reset()
+{
+  std::fill(buffer.begin(), buffer.end(), sample{0.0f, 0.0f});
+  // the first output frame lines up with the first input frame
+  position = taps;
+}
+
+std::size_t OutputResampler::maxOutputFrames(std::size_t inputFrames) const
+{
+  return std::size_t(std::ceil(inputFrames / step)) + 2;
+}
+
+std::size_t OutputResampler::process(const sample* input, std::size_t frames, sample* output)
+{
+  if (!active) {
+    std::copy(input, input + frames, output);
+    return frames;
+  }
+
+  // buffer holds the last taps input frames followed by this block
+  std::copy(input, input + frames, buffer.begin() + taps);
+  std::size_t available = taps + frames;
+  std::size_t written = 0;
+  while (std::size_t(position) + taps / 2 < available) {
+    std::size_t base = std::size_t(position);
+    double phase = (position - base) * phases;
+    int p = int(phase);
+    float a = float(phase - p);
+    const float* k0 = &kernel[std::size_t(p) * taps];
+    const float* k1 = k0 + taps;
+    const sample* x = &buffer[base + 1 - taps / 2];
+    float left = 0, right = 0;
+    for (int i = 0; i < taps; i++) {
+      float k = k0[i] + (k1[i] - k0[i]) * a;
+      left += x[i].left * k;
+      right += x[i].right * k;
+    }
+    output[written++] = sample{left, right};
+    position += step;
+  }
+
+  std::copy(buffer.begin() + frames, buffer.begin() + frames + taps, buffer.begin());
+  position -= frames;
+  return written;
+}
+
+std::size_t OutputResampler::flush(sample* output)
+{
+  static const sample zeros[taps / 2] = {};
+  return process(zeros, taps / 2, output);
+}
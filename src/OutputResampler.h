@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include "Types.h"
+
+// Streaming stereo sample rate converter for the final output stage. Uses a
+// windowed-sinc kernel stored as a polyphase table, linearly interpolated
+// between neighbouring phases so any pair of rates works. All buffers are
+// allocated by setRates(), so process() is safe to call on the mixer thread.
+class OutputResampler
+{
+public:
+  OutputResampler();
+
+  void setRates(double inputRate, double outputRate, std::size_t maxInputFrames);
+  bool isActive() const;
+  void reset();
+
+  // upper bound on the number of frames process() writes for one block
+  std::size_t maxOutputFrames(std::size_t inputFrames) const;
+  std::size_t process(const sample* input, std::size_t frames, sample* output);
+  // pushes the kernel's delay out at the end of a stream
+  std::size_t flush(sample* output);
+
+private:
+  static constexpr int taps = 32;
+  static constexpr int phases = 256;
+
+  std::vector<float> kernel;
+  std::vector<sample> buffer;
+  double step, position;
+  bool active;
+};
@@ -1,22 +1,27 @@
 #include "PianoKeys.h"
 #include <algorithm>
 #include <QPainter>
-#include <QPaintEvent>
-#include <QMouseEvent>
+#include <QPalette>
 
 static const int numWhiteKeys = 7 * 10 + 5;
-static const bool hasBlack[] = { true, true, false, true, true, true, false };
 static const bool isBlack[] = { false, true, false, true, false, false, true, false, true, false, true, false };
 static const int posInOctave[] = { 0, 0, 1, 1, 2, 3, 3, 4, 4, 5, 5, 6 };
 static const int posToNote[] = { 0, 2, 4, 5, 7, 9, 11 };
 
-PianoKeys::PianoKeys(QWidget* parent)
-: QWidget(parent)
+PianoKeys::PianoKeys()
+: whiteWidth(3), whiteHeight(0), blackOffset(2), blackWidth(2), blackHeight(0)
 {
-  setMinimumSize(numWhiteKeys * 3 + 1, 8);
-  setMaximumWidth(numWhiteKeys * 14 + 1);
-  setSizeIncrement(75, 2);
-  setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Minimum);
+  // initializers only
+}
+
+int PianoKeys::minimumWidth()
+{
+  return numWhiteKeys * 3 + 1;
+}
+
+int PianoKeys::maximumWidth()
+{
+  return numWhiteKeys * 14 + 1;
 }
 
 int PianoKeys::preferredWidth(int maxWidth)
@@ -28,14 +33,30 @@ int PianoKeys::preferredWidth(int maxWidth)
   return keyWidth * numWhiteKeys + 1;
 }
 
-void PianoKeys::setNoteOn(int noteNumber, bool on)
+void PianoKeys::resize(const QSize& size, qreal dpr, const QPalette& palette)
 {
-  if (activeKeys[noteNumber] != on) {
-    activeKeys[noteNumber] = on;
-    update(keyRect(noteNumber));
+  keyboardSize = size;
+  whiteWidth = size.width() / numWhiteKeys;
+  blackWidth = 2 * whiteWidth / 3;
+  blackOffset = 2 * whiteWidth / 3;
+  whiteHeight = size.height() - 1;
+  blackHeight = whiteHeight / 2;
+
+  for (bool active : { false, true }) {
+    QPixmap& px = active ? activeKeyboard : idleKeyboard;
+    px = QPixmap(size * dpr);
+    px.setDevicePixelRatio(dpr);
+    px.fill(Qt::transparent);
+    QPainter p(&px);
+    drawKeyboard(&p, palette, active);
   }
 }
 
+QSize PianoKeys::size() const
+{
+  return keyboardSize;
+}
+
 QRect PianoKeys::keyRect(int noteNum) const
 {
   int octave = noteNum / 12;
@@ -48,28 +69,14 @@ QRect PianoKeys::keyRect(int noteNum) const
   }
 }
 
-void PianoKeys::resizeEvent(QResizeEvent*)
-{
-  whiteWidth = width() / numWhiteKeys;
-  blackWidth = 2 * whiteWidth / 3;
-  blackOffset = 2 * whiteWidth / 3;
-  whiteHeight = height() - 1;
-  blackHeight = whiteHeight / 2;
-}
-
 int PianoKeys::noteAt(const QPoint& pos) const
 {
   int x = pos.x() / whiteWidth;
   return (x / 7) * 12 + posToNote[x % 7];
 }
 
-void PianoKeys::paintEvent(QPaintEvent* e)
+void PianoKeys::drawKeyboard(QPainter* p, const QPalette& pal, bool active) const
 {
-  int left = std::clamp(noteAt(e->rect().topLeft()) - 1, 0, 126);
-  int right = std::clamp(noteAt(e->rect().bottomRight()) + 1, left + 1, 127);
-
-  QPainter p(this);
-  QPalette pal = palette();
   QBrush white = pal.base();
   QBrush altWhite = pal.alternateBase();
   QBrush black = pal.shadow();
@@ -78,36 +85,70 @@ void PianoKeys::paintEvent(QPaintEvent* e)
   QColor lightFrame(pal.color(QPalette::Highlight).darker(150));
 
   // First draw the white keys
-  for (int i = left; i <= right; i++) {
+  for (int i = 0; i < 128; i++) {
     int degree = i % 12;
     if (isBlack[degree]) {
       continue;
     }
     QRect r = keyRect(i);
-    if (activeKeys[i]) {
-      p.fillRect(r, light);
-      p.setPen(lightFrame);
+    if (active) {
+      p->fillRect(r, light);
+      p->setPen(lightFrame);
     } else {
-      p.fillRect(r, degree == 0 ? altWhite : white);
-      p.setPen(QPalette::Text);
+      p->fillRect(r, degree == 0 ? altWhite : white);
+      p->setPen(QPalette::Text);
     }
-    p.drawRect(r);
+    p->drawRect(r);
   }
 
   // Then draw the black keys on top
-  for (int i = left; i <= right; i++) {
+  for (int i = 0; i < 128; i++) {
     int degree = i % 12;
     if (!isBlack[degree]) {
       continue;
     }
     QRect r = keyRect(i);
-    if (activeKeys[i]) {
-      p.fillRect(r, blackLight);
-      p.setPen(lightFrame);
+    if (active) {
+      p->fillRect(r, blackLight);
+      p->setPen(lightFrame);
     } else {
-      p.fillRect(r, black);
-      p.setPen(QPalette::Text);
+      p->fillRect(r, black);
+      p->setPen(QPalette::Text);
+    }
+    p->drawRect(r);
+  }
+}
+
+void PianoKeys::blit(QPainter* p, const QPoint& origin, const QPixmap& source, const QRect& rect) const
+{
+  qreal dpr = source.devicePixelRatio();
+  p->drawPixmap(rect.translated(origin), source, QRectF(rect.topLeft() * dpr, rect.size() * dpr));
+}
+
+void PianoKeys::paint(QPainter* p, const QPoint& origin, const QRect& clip, const std::bitset<128>& activeKeys) const
+{
+  QRect area = clip & QRect(QPoint(0, 0), keyboardSize);
+  if (area.isEmpty() || !whiteWidth) {
+    return;
+  }
+  int left = std::clamp(noteAt(area.topLeft()) - 1, 0, 126);
+  int right = std::clamp(noteAt(area.bottomRight()) + 1, left + 1, 127);
+
+  p->save();
+  p->setClipRect(area.translated(origin), Qt::IntersectClip);
+  blit(p, origin, idleKeyboard, area);
+
+  // Active white keys include their frame, which may cover part of a
+  // neighboring black key, so every black key in the span is copied again.
+  for (int i = left; i <= right; i++) {
+    if (activeKeys[i] && !isBlack[i % 12]) {
+      blit(p, origin, activeKeyboard, keyRect(i).adjusted(0, 0, 1, 1));
+    }
+  }
+  for (int i = left; i <= right; i++) {
+    if (isBlack[i % 12]) {
+      blit(p, origin, activeKeys[i] ? activeKeyboard : idleKeyboard, keyRect(i).adjusted(0, 0, 1, 1));
     }
-    p.drawRect(r);
   }
+  p->restore();
 }
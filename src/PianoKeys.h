@@ -1,33 +1,42 @@
 #pragma once
 
-#include <QWidget>
+#include <QPixmap>
+#include <QRect>
 #include <bitset>
+class QPainter;
+class QPalette;
 
-class PianoKeys : public QWidget
+// Renders a 128-key keyboard. The idle and fully-lit keyboards are drawn once
+// per size, and painting copies keys out of those pixmaps, so a single
+// instance can be shared by every track row.
+class PianoKeys
 {
-Q_OBJECT
 public:
-  PianoKeys(QWidget* parent = nullptr);
+  PianoKeys();
 
+  static int minimumWidth();
+  static int maximumWidth();
   static int preferredWidth(int maxWidth);
 
-public slots:
-  void setNoteOn(int noteNumber, bool on);
+  void resize(const QSize& size, qreal dpr, const QPalette& palette);
+  QSize size() const;
+  QRect keyRect(int noteNum) const;
 
-protected:
-  void resizeEvent(QResizeEvent*);
-  void paintEvent(QPaintEvent*);
+  // Paints the part of the keyboard inside clip, which is given in keyboard
+  // coordinates, with its top-left corner at origin.
+  void paint(QPainter* p, const QPoint& origin, const QRect& clip, const std::bitset<128>& activeKeys) const;
 
 private:
-  QRect keyRect(int noteNum) const;
   int noteAt(const QPoint& pos) const;
+  void drawKeyboard(QPainter* p, const QPalette& pal, bool active) const;
+  void blit(QPainter* p, const QPoint& origin, const QPixmap& source, const QRect& rect) const;
 
-  int keyboardLeft;
+  QSize keyboardSize;
   int whiteWidth;
   int whiteHeight;
   int blackOffset;
   int blackWidth;
   int blackHeight;
 
-  std::bitset<128> activeKeys;
+  QPixmap idleKeyboard, activeKeyboard;
 };
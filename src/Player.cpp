@@ -6,6 +6,12 @@
 #include "UiUtils.h"
 #include "Debug.h"
 #include "RiffWriter.h"
+#include <QSettings>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QCryptographicHash>
+#include <chrono>
+#include <cmath>
 #include <QtDebug>
 
 // first portaudio hostapi has highest priority, last hostapi has lowest
@@ -23,11 +29,66 @@ static const std::vector<PaHostApiTypeId> hostApiPriority = {
   paSoundManager,
 };
 
+// Opens the PortAudio stream the first time something is played, so the
+// window can appear before any audio device has been touched.
+void Player::openStream()
+{
+  if (audioStream) {
+    return;
+  }
+  QElapsedTimer elapsed;
+  elapsed.start();
+  if (!portAudioReady) {
+    PaError err = Pa_Initialize();
+    if (err != paNoError) {
+      throw Xcept("Pa_Initialize(): unable to initialize PortAudio: %s", Pa_GetErrorText(err));
+    }
+    portAudioReady = true;
+  }
+  detectHostApi();
+  Debug::print("Audio output opened in %lld ms", (long long)elapsed.elapsed());
+}
+
+void Player::closeStream()
+{
+  if (!audioStream) {
+    return;
+  }
+  PaError err = Pa_CloseStream(audioStream);
+  if (err != paNoError) {
+    Debug::print("Pa_CloseStream: %s", Pa_GetErrorText(err));
+  }
+  audioStream = nullptr;
+}
+
 void Player::detectHostApi()
 {
   outputStreamParameters.channelCount = 2;    // stereo
   outputStreamParameters.sampleFormat = paFloat32;
 
+  // The device that worked last time only needs to be opened once to confirm
+  // it is still there. Devices are remembered by name because PortAudio's
+  // indices change when devices come and go.
+  QSettings settings;
+  if (settings.contains("audioHostApi")) {
+    const PaHostApiIndex hostApiIndex = Pa_HostApiTypeIdToHostApiIndex(PaHostApiTypeId(settings.value("audioHostApi").toInt()));
+    const PaHostApiInfo *apiInfo = hostApiIndex >= 0 ? Pa_GetHostApiInfo(hostApiIndex) : nullptr;
+    const QString deviceName = settings.value("audioDevice").toString();
+    for (int i = 0; apiInfo && i < apiInfo->deviceCount; i++) {
+      const PaDeviceIndex deviceIndex = Pa_HostApiDeviceIndexToDeviceIndex(hostApiIndex, i);
+      const PaDeviceInfo *devInfo = Pa_GetDeviceInfo(deviceIndex);
+      if (devInfo && devInfo->maxOutputChannels > 0 && deviceName == QString::fromUtf8(devInfo->name)) {
+        if (openDevice(hostApiIndex, deviceIndex)) {
+          return;
+        }
+        break;
+      }
+    }
+    Debug::print("Cached audio device \"%s\" is not available, probing host APIs", qPrintable(deviceName));
+    settings.remove("audioHostApi");
+    settings.remove("audioDevice");
+  }
+
   // init host api
   std::vector<PaHostApiTypeId> hostApiPrioritiesWithFallback = hostApiPriority;
   const PaHostApiIndex defaultHostApiIndex = Pa_GetDefaultHostApi();
@@ -50,59 +111,125 @@ void Player::detectHostApi()
     if (apiInfo == nullptr)
       throw Xcept("Pa_GetHostApiInfo with valid index failed");
     const PaDeviceIndex deviceIndex = apiInfo->defaultOutputDevice;
+    if (!openDevice(hostApiIndex, deviceIndex))
+      continue;
 
-    const PaDeviceInfo *devInfo = Pa_GetDeviceInfo(deviceIndex);
-    if (devInfo == nullptr)
-      throw Xcept("Pa_GetDeviceInfo(): failed with valid index");
+    settings.setValue("audioHostApi", int(apiType));
+    settings.setValue("audioDevice", QString::fromUtf8(Pa_GetDeviceInfo(deviceIndex)->name));
+    return;
+  }
 
-    outputStreamParameters.device = deviceIndex;
-    outputStreamParameters.suggestedLatency = devInfo->defaultLowOutputLatency;
-    outputStreamParameters.hostApiSpecificStreamInfo = nullptr;
+  throw Xcept("Unable to initialize sound output: Host API could not be initialized");
+}
+
+bool Player::openDevice(PaHostApiIndex hostApiIndex, PaDeviceIndex deviceIndex)
+{
+  const PaHostApiInfo *apiInfo = Pa_GetHostApiInfo(hostApiIndex);
+  if (apiInfo == nullptr)
+    throw Xcept("Pa_GetHostApiInfo with valid index failed");
+  const PaDeviceInfo *devInfo = Pa_GetDeviceInfo(deviceIndex);
+  if (devInfo == nullptr)
+    throw Xcept("Pa_GetDeviceInfo(): failed with valid index");
+
+  LatencySettings latency = latencySettings(latencyProfile);
+  outputStreamParameters.device = deviceIndex;
+  outputStreamParameters.suggestedLatency = latency.highLatency ? devInfo->defaultHighOutputLatency : devInfo->defaultLowOutputLatency;
+  outputStreamParameters.hostApiSpecificStreamInfo = nullptr;
 
 #if __has_include(<pa_win_wasapi.h>)
-    if (apiType == paWASAPI) {
-      memset(&wasapiStreamInfo, 0, sizeof(wasapiStreamInfo));
-      wasapiStreamInfo.size = sizeof(wasapiStreamInfo);
-      wasapiStreamInfo.hostApiType = paWASAPI;
-      wasapiStreamInfo.version = 1;
-      wasapiStreamInfo.flags = paWinWasapiAutoConvert;
-    }
+  if (apiInfo->type == paWASAPI) {
+    memset(&wasapiStreamInfo, 0, sizeof(wasapiStreamInfo));
+    wasapiStreamInfo.size = sizeof(wasapiStreamInfo);
+    wasapiStreamInfo.hostApiType = paWASAPI;
+    wasapiStreamInfo.version = 1;
+    wasapiStreamInfo.flags = paWinWasapiAutoConvert;
+  }
 #endif
 
-    PaError err = Pa_OpenStream(&audioStream, nullptr, &outputStreamParameters, STREAM_SAMPLERATE, paFramesPerBufferUnspecified, paNoFlag, audioCallback, this);
-    if (err != paNoError) {
-      Debug::print("Pa_OpenStream(): unable to open stream with host API %s: %s", apiInfo->name, Pa_GetErrorText(err));
-      continue;
-    }
+  // Run the device at its native rate so the OS mixer doesn't resample a
+  // second time. The mixer thread converts from the engine's rate.
+  double deviceRate = devInfo->defaultSampleRate > 0 ? devInfo->defaultSampleRate : STREAM_SAMPLERATE;
+  PaError err = Pa_OpenStream(&audioStream, nullptr, &outputStreamParameters, deviceRate, latency.framesPerBuffer, paNoFlag, audioCallback, this);
+  if (err != paNoError && deviceRate != STREAM_SAMPLERATE) {
+    Debug::print("Pa_OpenStream(): unable to open stream at %g Hz with host API %s: %s", deviceRate, apiInfo->name, Pa_GetErrorText(err));
+    deviceRate = STREAM_SAMPLERATE;
+    err = Pa_OpenStream(&audioStream, nullptr, &outputStreamParameters, deviceRate, latency.framesPerBuffer, paNoFlag, audioCallback, this);
+  }
+  if (err != paNoError) {
+    Debug::print("Pa_OpenStream(): unable to open stream with host API %s: %s", apiInfo->name, Pa_GetErrorText(err));
+    audioStream = nullptr;
+    return false;
+  }
 
-    err = Pa_StartStream(audioStream);
+  err = Pa_StartStream(audioStream);
+  if (err != paNoError) {
+    Debug::print("Pa_StartStream(): unable to start stream for Host API %s: %s", apiInfo->name, Pa_GetErrorText(err));
+    err = Pa_CloseStream(audioStream);
     if (err != paNoError) {
-      Debug::print("Pa_StartStream(): unable to start stream for Host API %s: %s", apiInfo->name, Pa_GetErrorText(err));
-      err = Pa_CloseStream(audioStream);
-      if (err != paNoError) {
-        Debug::print("Pa_CloseStream(): unable to close stream for Host API %s: %s", apiInfo->name, Pa_GetErrorText(err));
-      }
-      audioStream = nullptr;
-      continue;
+      Debug::print("Pa_CloseStream(): unable to close stream for Host API %s: %s", apiInfo->name, Pa_GetErrorText(err));
     }
-    Pa_StopStream(audioStream);
-    return;
+    audioStream = nullptr;
+    return false;
   }
+  Pa_StopStream(audioStream);
+  outputSampleRate = deviceRate;
+  return true;
+}
 
-  throw Xcept("Unable to initialize sound output: Host API could not be initialized");
+ExportConfig ExportConfig::current()
+{
+  const ConfigManager& manager = ConfigManager::Instance();
+  const GameConfig& cfg = manager.GetCfg();
+  ExportConfig config;
+  config.maxLoops = manager.GetMaxLoopsExport();
+  config.trackLimit = cfg.GetTrackLimit();
+  config.pcmVol = cfg.GetPCMVol();
+  config.engineRev = cfg.GetEngineRev();
+  config.engineFreq = cfg.GetEngineFreq();
+  config.padSecondsStart = manager.GetPadSecondsStart();
+  config.padSecondsEnd = manager.GetPadSecondsEnd();
+  QSettings settings;
+  config.sampleRate = settings.value("exportSampleRate", 0).toInt();
+  config.loopExport = settings.value("exportLoops", false).toBool();
+  config.loopCopies = settings.value("exportLoopCopies", 0).toInt();
+  config.loopFadeSeconds = settings.value("exportLoopFade", 5.0).toDouble();
+  config.silenceSeconds = settings.value("exportSilenceSeconds", 0.0).toDouble();
+  config.silenceLevel = float(std::pow(10.0, settings.value("exportSilenceThreshold", -80).toInt() / 20.0));
+  config.budget.maxRenderSeconds = settings.value("exportMaxSeconds", 3600.0).toDouble();
+  config.budget.maxWallSeconds = settings.value("exportMaxWallSeconds", 600.0).toDouble();
+  return config;
 }
 
-Player::Player(QObject* parent)
-: QObject(parent), ctx(nullptr), playerState(State::TERMINATED), audioStream(nullptr),
-  speedFactor(64), rBuf(STREAM_BUF_SIZE)
+EnginePars ExportConfig::enginePars() const
 {
-  detectHostApi();
+  return EnginePars(pcmVol, engineRev, engineFreq);
+}
 
+static std::unique_ptr<PlayerContext> makeContext()
+{
+  const auto& cfg = ConfigManager::Instance().GetCfg();
+  return std::make_unique<PlayerContext>(
+    ConfigManager::Instance().GetMaxLoopsPlaylist(),
+    cfg.GetTrackLimit(),
+    EnginePars(cfg.GetPCMVol(), cfg.GetEngineRev(), cfg.GetEngineFreq())
+  );
+}
+
+Player::Player(QObject* parent)
+: QObject(parent), ctx(nullptr), queuedCtx(nullptr), queuedFade(nullptr), nextQueued(false), nextIndex(-1), nextAddr(0),
+  playerState(State::TERMINATED), closingEngine(false), portAudioReady(false), audioStream(nullptr), speedFactor(64), speed(1.0),
+  latencyProfile(savedLatencyProfile()), rBuf(new Ringbuffer(STREAM_BUF_SIZE)), ringBufferFrames(STREAM_BUF_SIZE), outputSampleRate(STREAM_SAMPLERATE),
+  mixerCpu(QSettings().value("mixerCpu", -1).toInt()),
+#ifdef HAVE_JACK
+  useJack(QSettings().value("jackBackend", false).toBool()),
+#endif
+  displayRate(60), idleTicks(0), updatesRunning(false)
+{
   model = new SongModel(this);
+  updateRenderCacheLimits();
 
   timer.setTimerType(Qt::PreciseTimer);
   timer.setSingleShot(false);
-  timer.setInterval(1000/30);
   QObject::connect(&timer, SIGNAL(timeout()), &updateThrottle, SLOT(start()));
 
   updateThrottle.setSingleShot(true);
@@ -112,33 +239,40 @@ Player::Player(QObject* parent)
 
 Player::~Player()
 {
-  if (audioStream) {
-    Pa_StopStream(audioStream);
-    PaError err = Pa_CloseStream(audioStream);
-    if (err != paNoError) {
-      Debug::print("Pa_CloseStream: %s", Pa_GetErrorText(err));
-    }
+  // the mixer thread stops the stream when closeEngine() ends it
+  closeEngine();
+  closeStream();
+  if (portAudioReady && Pa_Terminate() != paNoError) {
+    Debug::print("Error while terminating portaudio");
   }
 }
 
 Rom* Player::openRom(const QString& path)
 {
-  stop();
+  // the new game may run the engine at a different rate
+  closeEngine();
+  nextCtx.reset();
   if (path.isEmpty()) {
     ctx.reset();
     return nullptr;
   }
 
   Rom::CreateInstance(qPrintable(path));
+  // identifies the ROM in the render cache by its contents, so a copy or a
+  // patched file at the same path gets its own entries
+  QFile romFile(path);
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  if (romFile.open(QIODevice::ReadOnly) && hash.addData(&romFile)) {
+    romId = QString::fromLatin1(hash.result().toHex());
+  } else {
+    // the render cache stays unused for this ROM
+    romId.clear();
+  }
   Rom* rom = &Rom::Instance();
   ConfigManager::Instance().SetGameCode(rom->GetROMCode());
-  const auto& cfg = ConfigManager::Instance().GetCfg();
 
-  ctx = std::make_unique<PlayerContext>(
-    ConfigManager::Instance().GetMaxLoopsPlaylist(),
-    cfg.GetTrackLimit(),
-    EnginePars(cfg.GetPCMVol(), cfg.GetEngineRev(), cfg.GetEngineFreq())
-  );
+  ctx = makeContext();
+  ctx->reader.SetSpeedFactor(speed);
 
   songTableAddrs.clear();
   for (SongTable& table : SongTable::ScanForTables()) {
@@ -174,14 +308,76 @@ SongModel* Player::songModel() const
 
 void Player::selectSong(int index)
 {
-  stop();
+  if (!stopMixer()) {
+    return;
+  }
   QModelIndex idx = model->index(index, 0);
   std::uint32_t addr = model->songAddress(idx);
   ctx->InitSong(addr);
 
+  vuState.setSampleRate(ctx->mixer.GetSampleRate());
   vuState.setTrackCount(int(ctx->seq.tracks.size()));
 
   emit songChanged(ctx.get(), addr, idx.data(Qt::DisplayRole).toString());
+  publishSnapshot();
+  update();
+}
+
+void Player::queueSong(int index)
+{
+  if (!ctx) {
+    return;
+  }
+  PlayerContext* queued = queuedCtx.exchange(nullptr);
+  if (!queued && nextQueued) {
+    // The mixer has already moved on to the queued song. advanceSong() is
+    // pending and the caller will be asked for a new one after it runs.
+    return;
+  }
+  nextQueued = false;
+  queuedFade = nullptr;
+  crossfadeThread.reset();
+  if (index < 0) {
+    return;
+  }
+
+  if (!nextCtx) {
+    nextCtx = makeContext();
+  }
+  nextIndex = index;
+  nextAddr = model->songAddress(model->index(index, 0));
+  nextCtx->InitSong(nextAddr);
+  nextCtx->reader.SetSpeedFactor(speed);
+
+  double crossfade = QSettings().value("crossfadeSeconds", 0.0).toDouble();
+  if (crossfade > 0) {
+    // the helper waits until the mixer starts the crossfade
+    crossfadeThread.reset(new CrossfadeThread(this, nextCtx.get(), crossfade));
+    crossfadeThread->start();
+    queuedFade = crossfadeThread.get();
+  }
+  nextQueued = true;
+  queuedCtx = nextCtx.get();
+}
+
+void Player::advanceSong()
+{
+  // Only act if the mixer actually took the queued context. stop() may have
+  // already done this, or the song may have been replaced in the meantime.
+  if (!nextQueued || queuedCtx.load() != nullptr) {
+    return;
+  }
+  nextQueued = false;
+  queuedFade = nullptr;
+  crossfadeThread.reset();
+  // the previous context stays around to prepare the song after this one
+  ctx.swap(nextCtx);
+
+  QModelIndex idx = model->index(nextIndex, 0);
+  emit songChanged(ctx.get(), nextAddr, idx.data(Qt::DisplayRole).toString());
+  State state = playerState;
+  emit stateChanged(state == State::RESTART || state == State::PLAYING || state == State::PAUSED, state == State::PAUSED);
+  emit songAdvanced(nextIndex);
 }
 
 void Player::play()
@@ -191,12 +387,46 @@ void Player::play()
   }
   try {
     if (!playerThread) {
+#ifdef HAVE_JACK
+      if (useJack && (!jack || jack->blockSize() != ctx->mixer.GetSamplesPerBuffer())) {
+        jack.reset();
+        try {
+          std::size_t jackFrames = latencySettings(latencyProfile).ringBufferFrames * ctx->mixer.GetSampleRate() / STREAM_SAMPLERATE;
+          jack.reset(new JackOutput(AudioThread::maxTracks, ctx->mixer.GetSampleRate(), ctx->mixer.GetSamplesPerBuffer(), jackFrames));
+        } catch (std::exception& e) {
+          // no JACK server running: keep using PortAudio
+          Debug::print(e.what());
+        }
+      }
+#endif
+#ifdef HAVE_JACK
+      if (!jack)
+#endif
+      openStream();
+      // The ring buffer has to hold at least two mixer blocks, whose size is
+      // fixed by the engine. It can only be replaced while the stream is idle.
+      double outputRatio = outputSampleRate / ctx->mixer.GetSampleRate();
+      std::size_t outputBlock = std::size_t(std::ceil(ctx->mixer.GetSamplesPerBuffer() * outputRatio)) + 2;
+      std::size_t frames = std::max(std::size_t(latencySettings(latencyProfile).ringBufferFrames * outputSampleRate / STREAM_SAMPLERATE), 2 * outputBlock);
+      if (frames != ringBufferFrames) {
+        rBuf.reset(new Ringbuffer(frames));
+        ringBufferFrames = frames;
+      }
+      drainCommands();
+      prepareRenderCache();
+      // The mixer thread and the stream stay up until the ROM or the output
+      // settings change, so later songs start at the next block.
       playerThread.reset(new PlayerThread(this));
-      QObject::connect(playerThread.get(), SIGNAL(finished()), this, SLOT(playbackDone()), Qt::QueuedConnection);
+      QObject::connect(playerThread.get(), SIGNAL(finished()), this, SLOT(engineFinished()), Qt::QueuedConnection);
       playerThread->start();
     } else {
       State state = playerState;
-      if (state == State::PLAYING) {
+      if (state == State::TERMINATED) {
+        // the idle mixer picks up the current song
+        drainCommands();
+        prepareRenderCache();
+        setState(State::RESTART);
+      } else if (state == State::PLAYING) {
         setState(State::RESTART);
       } else if (state == State::PAUSED) {
         setState(State::PLAYING);
@@ -204,15 +434,17 @@ void Player::play()
     }
   } catch (std::exception& e) {
     Debug::print(e.what());
+    replayEntry.reset();
+    recorder.reset();
     emit threadError(tr("An error occurred while preparing to play:\n\n%1").arg(e.what()));
     return;
   }
-  timer.start();
+  startUpdates();
 }
 
 void Player::pause()
 {
-  timer.stop();
+  stopUpdates();
   if (!ctx || !playerThread) {
     return;
   }
@@ -221,35 +453,188 @@ void Player::pause()
     setState(State::PAUSED);
   } else if (state == State::PAUSED) {
     setState(State::PLAYING);
-    timer.start();
+    startUpdates();
   }
 }
 
 void Player::stop()
 {
-  timer.stop();
+  stopMixer();
+}
+
+// Returns false if the mixer thread is wedged, in which case it may still be
+// using the contexts.
+bool Player::stopMixer()
+{
+  stopUpdates();
   if (!ctx) {
-    return;
+    return true;
+  }
+  // a pending restart is acknowledged first so it can't override the stop
+  if (!waitForMixer(State::RESTART)) {
+    return false;
   }
-  while (playerState == State::RESTART) {
-    QThread::msleep(5);
+  bool running;
+  {
+    // checked and set in one go, since the mixer may reach the end of the
+    // song and go idle at any moment
+    QMutexLocker lock(&stateMutex);
+    running = playerState != State::TERMINATED;
+    if (running) {
+      playerState = State::SHUTDOWN;
+    }
   }
-  if (playerState != State::TERMINATED) {
-    setState(State::SHUTDOWN);
+  if (running) {
+    emit stateChanged(false, false);
+    if (!waitForMixer(State::SHUTDOWN)) {
+      return false;
+    }
   }
-  while (playerState != State::TERMINATED) {
-    QThread::msleep(5);
+  // the mixer is idle now and no longer reads commands or the context
+  drainCommands();
+  if (nextQueued && !queuedCtx.load()) {
+    // the mixer advanced right before stopping
+    advanceSong();
   }
+  queuedCtx = nullptr;
+  queuedFade = nullptr;
+  crossfadeThread.reset();
+  nextQueued = false;
+  return true;
 }
 
 void Player::playbackDone()
 {
+  // The mixer has gone idle after the song stopped or ended. play() may
+  // already have woken it up again, so the state is only reported here.
+  State state = playerState;
+  emit stateChanged(state == State::RESTART || state == State::PLAYING || state == State::PAUSED, state == State::PAUSED);
+  update();
+}
+
+void Player::engineFinished()
+{
+  // closeEngine() has already cleaned up unless the mixer stopped on its own
+  // after an error
+  if (!playerThread || !playerThread->isFinished()) {
+    return;
+  }
   playerThread.reset();
+  // set if the mixer was aborted after it wedged
+  closingEngine = false;
+  collectRecording();
   setState(State::TERMINATED);
   vuState.reset();
+  publishSnapshot();
   update();
 }
 
+void Player::recordingDone()
+{
+  // a newer recorder may already have replaced the one that finished
+  if (recorder && recorder->isFinished()) {
+    collectRecording();
+  }
+}
+
+void Player::updateRenderCacheLimits()
+{
+  QSettings settings;
+  std::size_t megabyte = 1024 * 1024;
+  renderCache.setLimits(settings.value("renderCacheMB", 0).toUInt() * megabyte, settings.value("renderCacheSpillMB", 0).toUInt() * megabyte);
+}
+
+// Decides how the song about to start is played: from cached audio if it
+// has been rendered with the same settings before, otherwise live while a
+// recorder keeps a copy. Only called while the mixer is idle or not running.
+void Player::prepareRenderCache()
+{
+  collectRecording();
+  replayEntry.reset();
+  // cached audio has no mutes and plays at normal speed, and songs that loop
+  // forever never finish recording
+  if (!renderCache.isEnabled() || romId.isEmpty() || speed != 1.0 || ConfigManager::Instance().GetMaxLoopsPlaylist() < 0) {
+    return;
+  }
+  for (const auto& track : ctx->seq.tracks) {
+    if (track.muted) {
+      return;
+    }
+  }
+  QString key = renderKey();
+  replayEntry = renderCache.find(key);
+  if (!replayEntry) {
+    recorder.reset(new RenderRecorder(key, ctx->mixer.GetSamplesPerBuffer(), renderCache.memoryLimit() / sizeof(sample)));
+    QObject::connect(recorder.get(), SIGNAL(finished()), this, SLOT(recordingDone()), Qt::QueuedConnection);
+    recorder->start();
+  }
+}
+
+void Player::collectRecording()
+{
+  if (!recorder) {
+    return;
+  }
+  // The mixer has finished the recording by the time it goes idle, but not
+  // if it quit on an error, possibly before even picking it up.
+  if (!playerThread || playerThread->isFinished()) {
+    recorder->finish(false);
+  }
+  recorder->wait();
+  if (recorder->isComplete()) {
+    renderCache.insert(recorder->key(), recorder->takeFrames());
+  }
+  recorder.reset();
+}
+
+QString Player::renderKey() const
+{
+  // everything that changes the rendered master output
+  const ConfigManager& manager = ConfigManager::Instance();
+  const GameConfig& cfg = manager.GetCfg();
+  QStringList parts = {
+    romId,
+    QString::number(ctx->seq.GetSongHeaderPos(), 16),
+    QString::number(manager.GetMaxLoopsPlaylist()),
+    QString::number(int(manager.GetCgbPolyphony())),
+    QString::number(cfg.GetTrackLimit()),
+    QString::number(cfg.GetPCMVol()),
+    QString::number(cfg.GetEngineRev()),
+    QString::number(cfg.GetEngineFreq()),
+    QString::number(cfg.GetRevBufSize()),
+    QString::number(int(cfg.GetRevType())),
+    QString::number(int(cfg.GetResType())),
+    QString::number(int(cfg.GetResTypeFixed())),
+    QString::number(int(cfg.GetSimulateCGBSustainBug())),
+  };
+  return parts.join('|');
+}
+
+void Player::closeEngine()
+{
+  static constexpr unsigned long wedgedJoinMs = 2000;
+  bool stopped = stopMixer();
+  if (!playerThread) {
+    return;
+  }
+  closingEngine = true;
+  if (!stopped && !playerThread->wait(wedgedJoinMs)) {
+    // Aborting the output didn't free the mixer. It still uses the thread
+    // object and the context, so they are left behind instead of freed.
+    Debug::print("Mixer thread did not exit after the output was aborted");
+    (void)playerThread.release();
+    (void)ctx.release();
+    closingEngine = false;
+    return;
+  }
+  playerThread->wait();
+  closingEngine = false;
+  playerThread.reset();
+  collectRecording();
+  vuState.reset();
+  publishSnapshot();
+}
+
 void Player::togglePlay()
 {
   if (playerState == State::TERMINATED) {
@@ -261,22 +646,132 @@ void Player::togglePlay()
 
 void Player::setState(Player::State state)
 {
-  playerState = state;
+  acknowledgeState(state);
   emit stateChanged(state == State::RESTART || state == State::PLAYING || state == State::PAUSED, state == State::PAUSED);
 }
 
+// Changes the state without telling the GUI, waking up anyone waiting for
+// the mixer thread.
+void Player::acknowledgeState(Player::State state)
+{
+  QMutexLocker lock(&stateMutex);
+  playerState = state;
+  stateAcknowledged.wakeAll();
+}
+
+// Sleeps until the mixer thread has left the given state. It answers within
+// a block, so taking much longer means it is stuck, most likely waiting on
+// an audio device that stopped consuming. After a few timeouts it is treated
+// as wedged and told to shut down, and false is returned.
+bool Player::waitForMixer(Player::State state)
+{
+  static constexpr unsigned long timeoutMs = 1000;
+  static constexpr int maxTimeouts = 3;
+  QMutexLocker lock(&stateMutex);
+  int timeouts = 0;
+  while (playerState == state) {
+    if (!stateAcknowledged.wait(&stateMutex, timeoutMs) && playerState == state) {
+      Debug::print("Mixer thread has not responded for %lu ms (state %d)", timeoutMs, int(state));
+      if (++timeouts >= maxTimeouts) {
+        playerState = State::SHUTDOWN;
+        closingEngine = true;
+        lock.unlock();
+        abortOutput();
+        emit threadError(tr("The audio device stopped responding, so playback was stopped."));
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Unblocks a mixer thread that is stuck handing a block to the output.
+void Player::abortOutput()
+{
+#ifdef HAVE_JACK
+  if (jack) {
+    jack->abort();
+    return;
+  }
+#endif
+  if (audioStream) {
+    PaError err = Pa_AbortStream(audioStream);
+    if (err != paNoError) {
+      Debug::print("Pa_AbortStream: %s", Pa_GetErrorText(err));
+    }
+  }
+  // makes room for the block the mixer is trying to put
+  rBuf->Clear();
+}
+
+void Player::publishSnapshot()
+{
+  // Only valid while the mixer is idle or not running, since the triple
+  // buffer supports a single producer at a time.
+  snapshots.writeBuffer().capture(ctx.get(), &vuState);
+  snapshots.publish();
+}
+
 void Player::update()
 {
-  emit updated(ctx.get(), &vuState);
+  if (snapshots.update()) {
+    const SongSnapshot& snapshot = snapshots.readBuffer();
+    if (snapshot.differsVisibly(lastShown)) {
+      lastShown = snapshot;
+      idleTicks = 0;
+    } else {
+      idleTicks++;
+    }
+    emit updated(&snapshot);
+  } else {
+    idleTicks++;
+  }
+  scheduleUpdates();
 }
 
-void Player::setMute(int trackIdx, bool on)
+void Player::startUpdates()
 {
-  auto& track = ctx->seq.tracks[trackIdx];
-  if (track.muted != on) {
-    track.muted = on;
-    updateThrottle.start();
+  updatesRunning = true;
+  idleTicks = 0;
+  scheduleUpdates();
+}
+
+void Player::stopUpdates()
+{
+  updatesRunning = false;
+  timer.stop();
+}
+
+void Player::scheduleUpdates()
+{
+  if (!updatesRunning || displayRate <= 0) {
+    timer.stop();
+    return;
   }
+
+  // Follow the display while something is moving. After half a second
+  // without visible changes, poll a few times per second instead so a paused
+  // or silent song doesn't keep waking the CPU.
+  bool idle = idleTicks > displayRate / 2;
+  int interval = idle ? 250 : std::max(4, qRound(1000.0 / displayRate));
+  Qt::TimerType type = idle ? Qt::CoarseTimer : Qt::PreciseTimer;
+  if (timer.isActive() && timer.interval() == interval && timer.timerType() == type) {
+    return;
+  }
+  timer.stop();
+  timer.setTimerType(type);
+  timer.setInterval(interval);
+  timer.start();
+}
+
+void Player::setMute(int trackIdx, bool on)
+{
+  sendCommand(MixerCommand{ MixerCommand::Mute, 0, trackIdx, on, 0 });
+}
+
+void Player::setSolo(int trackIdx, bool on)
+{
+  sendCommand(MixerCommand{ MixerCommand::Solo, 0, trackIdx, on, 0 });
 }
 
 void Player::setSpeed(double mult)
@@ -284,7 +779,111 @@ void Player::setSpeed(double mult)
   if (!ctx) {
     return;
   }
-  ctx->reader.SetSpeedFactor(mult);
+  speed = mult;
+  // A queued context may already belong to the mixer, so it picks up the
+  // new speed from there when it switches over.
+  sendCommand(MixerCommand{ MixerCommand::Speed, 0, -1, false, mult });
+}
+
+void Player::sendCommand(MixerCommand command)
+{
+  if (!ctx) {
+    return;
+  }
+  if (!playerThread || playerState == State::TERMINATED) {
+    drainCommands();
+    applyCommand(command);
+    publishSnapshot();
+    updateThrottle.start();
+    return;
+  }
+
+  // Stamp the command with the frame the mixer is rendering right now,
+  // extrapolated from the last block it finished. Rendering is paced by the
+  // device, so this keeps the relative timing of quick successive clicks.
+  mixerClock.update();
+  const MixerClock& clock = mixerClock.readBuffer();
+  std::int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  double elapsed = std::max<std::int64_t>(0, now - clock.nanoseconds) * 1e-9;
+  command.frame = clock.frame + std::uint64_t(std::min(elapsed * ctx->mixer.GetSampleRate(), double(ctx->mixer.GetSamplesPerBuffer())));
+  if (!commands.push(command)) {
+    Debug::print("Mixer command queue is full, dropping command");
+  }
+}
+
+void Player::drainCommands()
+{
+  // whatever the mixer didn't get to before it went idle applies first
+  while (const MixerCommand* command = commands.front()) {
+    MixerCommand pending = *command;
+    commands.pop();
+    applyCommand(pending);
+  }
+}
+
+void Player::applyCommand(const MixerCommand& command)
+{
+  // only used while the mixer is idle or not running
+  auto& tracks = ctx->seq.tracks;
+  switch (command.type) {
+    case MixerCommand::Mute:
+      if (command.track >= 0 && command.track < int(tracks.size())) {
+        tracks[command.track].muted = command.on;
+      }
+      break;
+    case MixerCommand::Solo:
+      for (int i = 0; i < int(tracks.size()); i++) {
+        tracks[i].muted = command.on && i != command.track;
+      }
+      break;
+    case MixerCommand::Speed:
+      ctx->reader.SetSpeedFactor(command.speed);
+      break;
+  }
+}
+
+void Player::setVisibleMeters(quint32 tracks, bool master)
+{
+  vuState.visibleTracks = tracks;
+  vuState.masterVisible = master;
+}
+
+void Player::updateOutputSettings()
+{
+  updateRenderCacheLimits();
+  int cpu = QSettings().value("mixerCpu", -1).toInt();
+  if (cpu != mixerCpu) {
+    // the mixer thread is pinned when it starts
+    closeEngine();
+    mixerCpu = cpu;
+  }
+  LatencyProfile profile = savedLatencyProfile();
+#ifdef HAVE_JACK
+  bool jackBackend = QSettings().value("jackBackend", false).toBool();
+  if (jackBackend != useJack || profile != latencyProfile) {
+    // the client is recreated with the new settings on the next play()
+    closeEngine();
+    useJack = jackBackend;
+    jack.reset();
+  }
+#endif
+  if (profile == latencyProfile) {
+    return;
+  }
+  closeEngine();
+  latencyProfile = profile;
+  // reopened with the new latency on the next play()
+  closeStream();
+}
+
+void Player::setDisplayRate(qreal hz)
+{
+  if (hz == displayRate) {
+    return;
+  }
+  displayRate = hz;
+  idleTicks = 0;
+  scheduleUpdates();
 }
 
 int Player::audioCallback(const void*, void* output, unsigned long frames, const PaStreamCallbackTimeInfo*, PaStreamCallbackFlags, void* self)
@@ -294,7 +893,7 @@ int Player::audioCallback(const void*, void* output, unsigned long frames, const
 
 int Player::audioCallback(sample* output, size_t frames)
 {
-  rBuf.Take(output, frames);
+  rBuf->Take(output, frames);
   return 0;
 }
 
@@ -304,14 +903,16 @@ bool Player::exportToWave(const QString& filename, int track)
     return false;
   }
   try {
+    ExportConfig config = ExportConfig::current();
     QModelIndex idx = model->index(track, 0);
     quint32 addr = model->songAddress(idx);
     ExportItem item;
     item.outputPath = filename;
     item.trackAddr = addr;
     item.splitTracks = false;
+    item.config = config;
     exportQueue << item;
-    exportThread.reset(new ExportThread(this));
+    exportThread.reset(new ExportThread(this, config));
     QObject::connect(exportThread.get(), SIGNAL(finished()), this, SLOT(exportDone()), Qt::QueuedConnection);
     exportThread->start();
   } catch (std::exception& e) {
@@ -328,6 +929,7 @@ bool Player::exportToWave(const QDir& path, const QList<int>& tracks, bool split
     return false;
   }
   try {
+    ExportConfig config = ExportConfig::current();
     for (int track : tracks) {
       QModelIndex idx = model->index(track, 0);
       quint32 addr = model->songAddress(idx);
@@ -350,9 +952,10 @@ bool Player::exportToWave(const QDir& path, const QList<int>& tracks, bool split
       }
       item.trackAddr = addr;
       item.splitTracks = split;
+      item.config = config;
       exportQueue << item;
     }
-    exportThread.reset(new ExportThread(this));
+    exportThread.reset(new ExportThread(this, config));
     QObject::connect(exportThread.get(), SIGNAL(finished()), this, SLOT(exportDone()), Qt::QueuedConnection);
     exportThread->start();
   } catch (std::exception& e) {
@@ -4,6 +4,8 @@
 #include <QTimer>
 #include <QThread>
 #include <QDir>
+#include <QMutex>
+#include <QWaitCondition>
 #include <memory>
 #include <atomic>
 #include <portaudio.h>
@@ -15,13 +17,50 @@
 #include "SoundData.h"
 #include "Ringbuffer.h"
 #include "VUMeter.h"
+#include "SongSnapshot.h"
+#include "TripleBuffer.h"
+#include "LatencyProfile.h"
+#include "CommandQueue.h"
+#include "RenderCache.h"
+#include "ExportBudget.h"
+#ifdef HAVE_JACK
+#include "JackOutput.h"
+#endif
 class SongModel;
 class Rom;
+class CrossfadeThread;
+
+// Engine settings for an export, captured when it is queued so that
+// switching games or saving preferences during a batch doesn't change it.
+struct ExportConfig {
+  std::int8_t maxLoops;
+  std::uint8_t trackLimit;
+  std::uint8_t pcmVol, engineRev, engineFreq;
+  double padSecondsStart, padSecondsEnd;
+  // 0 keeps the engine's rate
+  int sampleRate;
+  // Stop once the song's loop has been found and mark it in the file, or
+  // write loopCopies passes of it followed by a fade if that's nonzero.
+  bool loopExport;
+  int loopCopies;
+  double loopFadeSeconds;
+  // End the song once it has been quieter than silenceLevel, with no notes
+  // playing, for silenceSeconds. 0 seconds turns this off.
+  double silenceSeconds;
+  float silenceLevel;
+  // Give up on a song that renders more audio, or takes longer to render,
+  // than this.
+  ExportBudget budget;
+
+  static ExportConfig current();
+  EnginePars enginePars() const;
+};
 
 struct ExportItem {
   QString outputPath;
   quint32 trackAddr;
   bool splitTracks;
+  ExportConfig config;
 };
 
 class Player : public QObject
@@ -30,15 +69,15 @@ Q_OBJECT
 friend class AudioThread;
 friend class PlayerThread;
 friend class ExportThread;
+friend class CrossfadeThread;
 public:
   Player(QObject* parent = nullptr);
   ~Player();
 
-  void detectHostApi();
-
   Rom* openRom(const QString& path);
   SongModel* songModel() const;
   void selectSong(int index);
+  void queueSong(int index);
 
   bool exportToWave(const QString& filename, int track);
   bool exportToWave(const QDir& path, const QList<int>& tracks, bool split);
@@ -48,7 +87,8 @@ signals:
   void songTablesFound(const std::vector<quint32>& addrs);
   void songTableUpdated(SongTable* table);
   void songChanged(PlayerContext* context, quint32 addr, const QString& name);
-  void updated(PlayerContext* context, VUState* vu);
+  void songAdvanced(int index);
+  void updated(const SongSnapshot* snapshot);
   void stateChanged(bool isPlaying, bool isPaused);
   void exportStarted(const QString& path);
   void exportFinished(const QString& path);
@@ -59,7 +99,11 @@ signals:
 public slots:
   void setSongTable(quint32 addr);
   void setMute(int trackIdx, bool on);
+  void setSolo(int trackIdx, bool on);
   void setSpeed(double mult);
+  void setVisibleMeters(quint32 tracks, bool master);
+  void setDisplayRate(qreal hz);
+  void updateOutputSettings();
 
   void play();
   void pause();
@@ -71,6 +115,9 @@ public slots:
 private slots:
   void update();
   void playbackDone();
+  void engineFinished();
+  void recordingDone();
+  void advanceSong();
   void exportDone();
 
 private:
@@ -80,7 +127,27 @@ private:
 
   static int audioCallback(const void*, void*, unsigned long, const PaStreamCallbackTimeInfo*, PaStreamCallbackFlags, void*);
   int audioCallback(sample* output, size_t frames);
+  void openStream();
+  void closeStream();
+  void closeEngine();
+  void detectHostApi();
+  bool openDevice(PaHostApiIndex hostApiIndex, PaDeviceIndex deviceIndex);
   void setState(State state);
+  void acknowledgeState(State state);
+  bool waitForMixer(State state);
+  void abortOutput();
+  bool stopMixer();
+  void publishSnapshot();
+  void sendCommand(MixerCommand command);
+  void applyCommand(const MixerCommand& command);
+  void drainCommands();
+  void updateRenderCacheLimits();
+  void prepareRenderCache();
+  void collectRecording();
+  QString renderKey() const;
+  void startUpdates();
+  void stopUpdates();
+  void scheduleUpdates();
 
   PaStreamParameters outputStreamParameters;
 #if __has_include(<pa_win_wasapi.h>)
@@ -90,20 +157,56 @@ private:
   QTimer timer, updateThrottle;
 
   std::unique_ptr<PlayerContext> ctx;
+  // prepared ahead of time so the mixer can continue into the next song
+  std::unique_ptr<PlayerContext> nextCtx;
+  std::atomic<PlayerContext*> queuedCtx;
+  std::unique_ptr<CrossfadeThread> crossfadeThread;
+  std::atomic<CrossfadeThread*> queuedFade;
+  bool nextQueued;
+  int nextIndex;
+  quint32 nextAddr;
   std::unique_ptr<SongTable> songTable;
   std::unique_ptr<QThread> playerThread;
   std::unique_ptr<QThread> exportThread;
   SongModel* model;
 
   std::atomic<State> playerState;
+  // lets stop() sleep until the mixer thread has moved on
+  QMutex stateMutex;
+  QWaitCondition stateAcknowledged;
   std::atomic<bool> abortExport;
+  std::atomic<bool> closingEngine;
 
+  bool portAudioReady;
   PaStream* audioStream;
   uint32_t speedFactor;
-  Ringbuffer rBuf;
+  // read by the mixer when it switches to another context
+  std::atomic<double> speed;
+  LatencyProfile latencyProfile;
+  std::unique_ptr<Ringbuffer> rBuf;
+  std::size_t ringBufferFrames;
+  double outputSampleRate;
+  int mixerCpu;
+#ifdef HAVE_JACK
+  bool useJack;
+  std::unique_ptr<JackOutput> jack;
+#endif
 
   VUState vuState;
+  TripleBuffer<SongSnapshot> snapshots;
+  SongSnapshot lastShown;
+  CommandQueue commands;
+  TripleBuffer<MixerClock> mixerClock;
+  qreal displayRate;
+  int idleTicks;
+  bool updatesRunning;
   std::vector<bool> mutedTracks;
+
+  // replays of recently played songs
+  RenderCache renderCache;
+  std::shared_ptr<const RenderCache::Entry> replayEntry;
+  std::unique_ptr<RenderRecorder> recorder;
+  QString romId;
   QList<ExportItem> exportQueue;
   std::vector<quint32> songTableAddrs;
 };
@@ -1,6 +1,7 @@
 #include "PlayerWindow.h"
 #include "TrackList.h"
 #include "VUMeter.h"
+#include "SongSnapshot.h"
 #include "RomView.h"
 #include "Rom.h"
 #include "ConfigManager.h"
@@ -28,6 +29,8 @@
 #include <QSettings>
 #include <QProgressBar>
 #include <QPushButton>
+#include <QWindow>
+#include <QScreen>
 #include <QtDebug>
 
 PlayerWindow::PlayerWindow(Player* player, QWidget* parent)
@@ -64,9 +67,12 @@ PlayerWindow::PlayerWindow(Player* player, QWidget* parent)
   QObject::connect(player, SIGNAL(songChanged(PlayerContext*,quint32,QString)), trackList, SLOT(selectSong(PlayerContext*,quint32,QString)));
   QObject::connect(player, SIGNAL(songChanged(PlayerContext*,quint32,QString)), songs, SLOT(songChanged(PlayerContext*,quint32)));
   QObject::connect(player, SIGNAL(songChanged(PlayerContext*,quint32,QString)), controls, SLOT(songChanged(PlayerContext*)));
-  QObject::connect(player, SIGNAL(updated(PlayerContext*,VUState*)), trackList, SLOT(update(PlayerContext*,VUState*)));
-  QObject::connect(player, SIGNAL(updated(PlayerContext*,VUState*)), this, SLOT(updateVU(PlayerContext*,VUState*)));
+  QObject::connect(player, SIGNAL(updated(const SongSnapshot*)), trackList, SLOT(update(const SongSnapshot*)));
+  QObject::connect(player, SIGNAL(songAdvanced(int)), this, SLOT(songAdvanced(int)));
+  QObject::connect(player, SIGNAL(updated(const SongSnapshot*)), this, SLOT(updateVU(const SongSnapshot*)));
   QObject::connect(trackList, SIGNAL(muteToggled(int,bool)), player, SLOT(setMute(int,bool)));
+  QObject::connect(trackList, SIGNAL(soloChanged(int,bool)), player, SLOT(setSolo(int,bool)));
+  QObject::connect(trackList, SIGNAL(visibleTracksChanged()), this, SLOT(updateMeterVisibility()));
   QObject::connect(controls, SIGNAL(togglePlay()), player, SLOT(togglePlay()));
   QObject::connect(controls, SIGNAL(play()), player, SLOT(play()));
   QObject::connect(controls, SIGNAL(pause()), player, SLOT(pause()));
@@ -76,6 +82,7 @@ PlayerWindow::PlayerWindow(Player* player, QWidget* parent)
   QObject::connect(player, SIGNAL(stateChanged(bool,bool)), songs, SLOT(stateChanged(bool,bool)));
   QObject::connect(recentsMenu, SIGNAL(triggered(QAction*)), this, SLOT(openRecent(QAction*)));
   QObject::connect(playlist, SIGNAL(playlistDirty(bool)), this, SLOT(playlistDirty(bool)));
+  QObject::connect(playlist, SIGNAL(playlistDirty(bool)), this, SLOT(queueNextSong()));
   QObject::connect(player, SIGNAL(exportStarted(QString)), this, SLOT(exportStarted(QString)));
   QObject::connect(player, SIGNAL(exportFinished(QString)), this, SLOT(exportFinished(QString)));
   QObject::connect(player, SIGNAL(exportError(QString)), this, SLOT(exportError(QString)));
@@ -167,6 +174,11 @@ void PlayerWindow::makeMenu()
   controlMenu->addAction(controls->pauseAction());
   controlMenu->addAction(controls->stopAction());
   controlMenu->addSeparator();
+  autoAdvanceAction = controlMenu->addAction(tr("Auto-&advance Playlist"));
+  autoAdvanceAction->setCheckable(true);
+  autoAdvanceAction->setChecked(QSettings().value("autoAdvance", true).toBool());
+  QObject::connect(autoAdvanceAction, SIGNAL(toggled(bool)), this, SLOT(setAutoAdvance(bool)));
+  controlMenu->addSeparator();
   QAction* prefsAction = controlMenu->addAction(tr("&Preferences..."), this, SLOT(openPreferences()), QKeySequence::Preferences);
   if (prefsAction->shortcut().isEmpty()) {
     prefsAction->setShortcut(Qt::CTRL | Qt::Key_Comma);
@@ -285,8 +297,11 @@ void PlayerWindow::selectSong(const QModelIndex& index)
     playlistIndex = index;
     songIndex = playlist->mapToSource(index);
   }
+  // only songs started from the playlist advance to the next entry
+  playingIndex = index.model() == songs ? QPersistentModelIndex() : QPersistentModelIndex(playlistIndex);
   try {
     player->selectSong(songIndex.row());
+    queueNextSong();
     QTimer::singleShot(0, player, SLOT(play()));
   } catch (std::exception& e) {
     QMessageBox::warning(nullptr, "agbplay", e.what());
@@ -298,6 +313,48 @@ void PlayerWindow::selectSong(const QModelIndex& index)
   }
 }
 
+void PlayerWindow::songAdvanced(int index)
+{
+  QModelIndex songIndex = songs->index(index, 0);
+  QModelIndex next;
+  if (playingIndex.isValid()) {
+    next = playlist->index(playingIndex.row() + 1);
+  }
+  if (!next.isValid() || playlist->mapToSource(next) != songIndex) {
+    // the playlist was edited after the song was queued
+    next = playlist->mapFromSource(songIndex);
+  }
+  playingIndex = next;
+  songList->scrollTo(songIndex);
+  if (next.isValid()) {
+    playlistView->setCurrentIndex(next);
+    playlistView->scrollTo(next);
+  }
+  queueNextSong();
+}
+
+void PlayerWindow::queueNextSong()
+{
+  int next = -1;
+  if (autoAdvanceAction->isChecked() && playingIndex.isValid()) {
+    QModelIndex nextIndex = playlist->index(playingIndex.row() + 1);
+    if (nextIndex.isValid()) {
+      next = playlist->mapToSource(nextIndex).row();
+    }
+  }
+  try {
+    player->queueSong(next);
+  } catch (std::exception& e) {
+    logMessage(e.what());
+  }
+}
+
+void PlayerWindow::setAutoAdvance(bool on)
+{
+  QSettings().setValue("autoAdvance", on);
+  queueNextSong();
+}
+
 void PlayerWindow::closeEvent(QCloseEvent*)
 {
   if (playlistIsDirty) {
@@ -309,10 +366,46 @@ void PlayerWindow::closeEvent(QCloseEvent*)
   player->stop();
 }
 
-void PlayerWindow::updateVU(PlayerContext*, VUState* vu)
+void PlayerWindow::updateVU(const SongSnapshot* snapshot)
+{
+  masterVU->setLeft(snapshot->master.left);
+  masterVU->setRight(snapshot->master.right);
+}
+
+void PlayerWindow::changeEvent(QEvent* e)
+{
+  QMainWindow::changeEvent(e);
+  if (e->type() == QEvent::WindowStateChange) {
+    updateMeterVisibility();
+  }
+}
+
+void PlayerWindow::showEvent(QShowEvent* e)
+{
+  QMainWindow::showEvent(e);
+  if (windowHandle()) {
+    QObject::connect(windowHandle(), SIGNAL(screenChanged(QScreen*)), this, SLOT(updateMeterVisibility()), Qt::UniqueConnection);
+  }
+  updateMeterVisibility();
+}
+
+void PlayerWindow::hideEvent(QHideEvent* e)
 {
-  masterVU->setLeft(vu->master.left);
-  masterVU->setRight(vu->master.right);
+  QMainWindow::hideEvent(e);
+  updateMeterVisibility();
+}
+
+void PlayerWindow::updateMeterVisibility()
+{
+  if (!isVisible() || isMinimized()) {
+    player->setVisibleMeters(0, false);
+    player->setDisplayRate(0);
+  } else {
+    player->setVisibleMeters(trackList->visibleTracks(), true);
+    QScreen* screen = windowHandle() ? windowHandle()->screen() : nullptr;
+    qreal rate = screen ? screen->refreshRate() : 0;
+    player->setDisplayRate(rate > 0 ? rate : 60);
+  }
 }
 
 void PlayerWindow::fillRecents()
@@ -552,6 +645,7 @@ void PlayerWindow::exportFinished(const QString& path)
 void PlayerWindow::exportError(const QString& message)
 {
   logMessage(tr("Error while exporting: %1").arg(message));
+  updateExportProgress();
 }
 
 void PlayerWindow::exportCancelled()
@@ -585,5 +679,6 @@ void PlayerWindow::openPreferences()
 {
   PreferencesWindow* prefs = new PreferencesWindow(this);
   prefs->setAttribute(Qt::WA_DeleteOnClose);
+  QObject::connect(prefs, SIGNAL(accepted()), player, SLOT(updateOutputSettings()));
   prefs->open();
 }
@@ -2,6 +2,7 @@
 
 #include <QMainWindow>
 #include <QItemSelection>
+#include <QPersistentModelIndex>
 #include <memory>
 #include "PlayerContext.h"
 class TrackList;
@@ -13,7 +14,7 @@ class QLabel;
 class QPlainTextEdit;
 class QProgressBar;
 class VUMeter;
-class VUState;
+struct SongSnapshot;
 class SongTable;
 class Player;
 class PlayerControls;
@@ -36,10 +37,17 @@ signals:
 
 protected:
   void closeEvent(QCloseEvent*);
+  void changeEvent(QEvent*);
+  void showEvent(QShowEvent*);
+  void hideEvent(QHideEvent*);
 
 private slots:
   void selectSong(const QModelIndex& index);
-  void updateVU(PlayerContext*, VUState* vu);
+  void songAdvanced(int index);
+  void queueNextSong();
+  void setAutoAdvance(bool on);
+  void updateVU(const SongSnapshot* snapshot);
+  void updateMeterVisibility();
   void clearRecents();
   void openRecent(QAction* action);
   void songListMenu(const QPoint& pos);
@@ -92,6 +100,9 @@ private:
   QAction* exportChannelsAction;
   QAction* exportAllAction;
   QAction* exportPlaylistAction;
+  QAction* autoAdvanceAction;
+
+  QPersistentModelIndex playingIndex;
 
   bool playlistIsDirty;
 };
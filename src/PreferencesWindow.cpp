@@ -1,5 +1,6 @@
 #include "PreferencesWindow.h"
 #include "ConfigManager.h"
+#include "LatencyProfile.h"
 #include <QVBoxLayout>
 #include <QGridLayout>
 #include <QDialogButtonBox>
@@ -7,6 +8,8 @@
 #include <QComboBox>
 #include <QSpinBox>
 #include <QCheckBox>
+#include <QSettings>
+#include <QThread>
 
 PreferencesWindow::PreferencesWindow(QWidget* parent)
 : QDialog(parent)
@@ -65,10 +68,131 @@ PreferencesWindow::PreferencesWindow(QWidget* parent)
   padSecondsEnd->setValue(cfg.GetPadSecondsEnd());
   padSecondsEnd->setMinimum(0);
 
+  QLabel* lblCrossfade = new QLabel(tr("Cross&fade between playlist songs:"), this);
+  layout->addWidget(lblCrossfade, 6, 0);
+  layout->addWidget(crossfadeSeconds = new QDoubleSpinBox(this), 6, 1);
+  layout->addWidget(new QLabel(tr("sec"), this), 6, 2);
+  lblCrossfade->setBuddy(crossfadeSeconds);
+  crossfadeSeconds->setRange(0, 30);
+  crossfadeSeconds->setSpecialValueText(tr("Off"));
+  crossfadeSeconds->setValue(QSettings().value("crossfadeSeconds", 0.0).toDouble());
+
+  QLabel* lblLatencyProfile = new QLabel(tr("Output la&tency:"), this);
+  layout->addWidget(lblLatencyProfile, 7, 0);
+  layout->addWidget(latencyProfile = new QComboBox(this), 7, 1, 1, 2);
+  lblLatencyProfile->setBuddy(latencyProfile);
+  for (LatencyProfile profile : { LatencyProfile::UltraLow, LatencyProfile::Balanced, LatencyProfile::PowerSaving }) {
+    latencyProfile->addItem(latencyProfileName(profile), int(profile));
+  }
+  latencyProfile->setCurrentIndex(latencyProfile->findData(int(savedLatencyProfile())));
+
+  QLabel* lblExportSampleRate = new QLabel(tr("Export sample &rate:"), this);
+  layout->addWidget(lblExportSampleRate, 8, 0);
+  layout->addWidget(exportSampleRate = new QComboBox(this), 8, 1, 1, 2);
+  lblExportSampleRate->setBuddy(exportSampleRate);
+  exportSampleRate->addItem(tr("Same as playback engine (Default)"), 0);
+  for (int rate : { 44100, 48000, 96000 }) {
+    exportSampleRate->addItem(tr("%L1 Hz").arg(rate), rate);
+  }
+  exportSampleRate->setCurrentIndex(qMax(0, exportSampleRate->findData(QSettings().value("exportSampleRate", 0).toInt())));
+
+#ifdef HAVE_JACK
+  layout->addWidget(jackBackend = new QCheckBox(tr("Use native &JACK output with per-track ports"), this), 9, 0, 1, 3);
+  jackBackend->setChecked(QSettings().value("jackBackend", false).toBool());
+#endif
+
+  QLabel* lblMixerCpu = new QLabel(tr("Pin &mixer thread to CPU:"), this);
+  layout->addWidget(lblMixerCpu, 10, 0);
+  layout->addWidget(mixerCpu = new QSpinBox(this), 10, 1, 1, 2);
+  lblMixerCpu->setBuddy(mixerCpu);
+  mixerCpu->setRange(-1, qMax(0, QThread::idealThreadCount() - 1));
+  mixerCpu->setSpecialValueText(tr("Off"));
+  mixerCpu->setValue(QSettings().value("mixerCpu", -1).toInt());
+
+  QLabel* lblRenderCache = new QLabel(tr("Cache rendered songs in memor&y:"), this);
+  layout->addWidget(lblRenderCache, 11, 0);
+  layout->addWidget(renderCacheMB = new QSpinBox(this), 11, 1);
+  layout->addWidget(new QLabel(tr("MB"), this), 11, 2);
+  lblRenderCache->setBuddy(renderCacheMB);
+  renderCacheMB->setRange(0, 4096);
+  renderCacheMB->setSingleStep(64);
+  renderCacheMB->setSpecialValueText(tr("Off"));
+  renderCacheMB->setValue(QSettings().value("renderCacheMB", 0).toInt());
+
+  QLabel* lblRenderCacheSpill = new QLabel(tr("Move older cached songs to dis&k:"), this);
+  layout->addWidget(lblRenderCacheSpill, 12, 0);
+  layout->addWidget(renderCacheSpillMB = new QSpinBox(this), 12, 1);
+  layout->addWidget(new QLabel(tr("MB"), this), 12, 2);
+  lblRenderCacheSpill->setBuddy(renderCacheSpillMB);
+  renderCacheSpillMB->setRange(0, 65536);
+  renderCacheSpillMB->setSingleStep(256);
+  renderCacheSpillMB->setSpecialValueText(tr("Off"));
+  renderCacheSpillMB->setValue(QSettings().value("renderCacheSpillMB", 0).toInt());
+
+  layout->addWidget(exportLoops = new QCheckBox(tr("Export the intro and one loo&p with loop points"), this), 13, 0, 1, 3);
+  exportLoops->setChecked(QSettings().value("exportLoops", false).toBool());
+
+  QLabel* lblExportLoopCopies = new QLabel(tr("Write the loop out instead, &with passes:"), this);
+  layout->addWidget(lblExportLoopCopies, 14, 0);
+  layout->addWidget(exportLoopCopies = new QSpinBox(this), 14, 1, 1, 2);
+  lblExportLoopCopies->setBuddy(exportLoopCopies);
+  exportLoopCopies->setRange(0, 99);
+  exportLoopCopies->setSpecialValueText(tr("Off"));
+  exportLoopCopies->setValue(QSettings().value("exportLoopCopies", 0).toInt());
+
+  QLabel* lblExportLoopFade = new QLabel(tr("Fa&de out after the last pass:"), this);
+  layout->addWidget(lblExportLoopFade, 15, 0);
+  layout->addWidget(exportLoopFade = new QDoubleSpinBox(this), 15, 1);
+  layout->addWidget(new QLabel(tr("sec"), this), 15, 2);
+  lblExportLoopFade->setBuddy(exportLoopFade);
+  exportLoopFade->setRange(0, 60);
+  exportLoopFade->setValue(QSettings().value("exportLoopFade", 5.0).toDouble());
+
+  QLabel* lblExportSilence = new QLabel(tr("E&nd exports after silence of:"), this);
+  layout->addWidget(lblExportSilence, 16, 0);
+  layout->addWidget(exportSilenceSeconds = new QDoubleSpinBox(this), 16, 1);
+  layout->addWidget(new QLabel(tr("sec"), this), 16, 2);
+  lblExportSilence->setBuddy(exportSilenceSeconds);
+  exportSilenceSeconds->setRange(0, 600);
+  exportSilenceSeconds->setSpecialValueText(tr("Off"));
+  exportSilenceSeconds->setValue(QSettings().value("exportSilenceSeconds", 0.0).toDouble());
+
+  QLabel* lblExportSilenceThreshold = new QLabel(tr("Silence t&hreshold:"), this);
+  layout->addWidget(lblExportSilenceThreshold, 17, 0);
+  layout->addWidget(exportSilenceThreshold = new QSpinBox(this), 17, 1);
+  layout->addWidget(new QLabel(tr("dBFS"), this), 17, 2);
+  lblExportSilenceThreshold->setBuddy(exportSilenceThreshold);
+  exportSilenceThreshold->setRange(-120, -20);
+  exportSilenceThreshold->setValue(QSettings().value("exportSilenceThreshold", -80).toInt());
+
+  QLabel* lblExportMaxSeconds = new QLabel(tr("Stop exporting a song &after audio of:"), this);
+  layout->addWidget(lblExportMaxSeconds, 18, 0);
+  layout->addWidget(exportMaxSeconds = new QSpinBox(this), 18, 1);
+  layout->addWidget(new QLabel(tr("sec"), this), 18, 2);
+  lblExportMaxSeconds->setBuddy(exportMaxSeconds);
+  exportMaxSeconds->setRange(0, 86400);
+  exportMaxSeconds->setSingleStep(60);
+  exportMaxSeconds->setSpecialValueText(tr("No limit"));
+  exportMaxSeconds->setValue(QSettings().value("exportMaxSeconds", 3600.0).toInt());
+
+  QLabel* lblExportMaxWallSeconds = new QLabel(tr("Stop exporting a song after renderin&g for:"), this);
+  layout->addWidget(lblExportMaxWallSeconds, 19, 0);
+  layout->addWidget(exportMaxWallSeconds = new QSpinBox(this), 19, 1);
+  layout->addWidget(new QLabel(tr("sec"), this), 19, 2);
+  lblExportMaxWallSeconds->setBuddy(exportMaxWallSeconds);
+  exportMaxWallSeconds->setRange(0, 86400);
+  exportMaxWallSeconds->setSingleStep(60);
+  exportMaxWallSeconds->setSpecialValueText(tr("No limit"));
+  exportMaxWallSeconds->setValue(QSettings().value("exportMaxWallSeconds", 600.0).toInt());
+  updateEnabled();
+
   QDialogButtonBox* buttons = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel, this);
-  layout->addWidget(buttons, 6, 0, 1, 3);
+  layout->addWidget(buttons, 20, 0, 1, 3);
 
   QObject::connect(loopInfinitely, SIGNAL(clicked()), this, SLOT(updateEnabled()));
+  QObject::connect(exportLoops, SIGNAL(clicked()), this, SLOT(updateEnabled()));
+  QObject::connect(exportLoopCopies, SIGNAL(valueChanged(int)), this, SLOT(updateEnabled()));
+  QObject::connect(exportSilenceSeconds, SIGNAL(valueChanged(double)), this, SLOT(updateEnabled()));
   QObject::connect(buttons, SIGNAL(accepted()), this, SLOT(save()));
   QObject::connect(buttons, SIGNAL(rejected()), this, SLOT(reject()));
 }
@@ -88,10 +212,29 @@ void PreferencesWindow::save()
   cfg.SetPadSecondsEnd(padSecondsEnd->value());
 
   cfg.Save();
+  QSettings().setValue("crossfadeSeconds", crossfadeSeconds->value());
+  saveLatencyProfile(LatencyProfile(latencyProfile->currentData().toInt()));
+  QSettings().setValue("exportSampleRate", exportSampleRate->currentData().toInt());
+  QSettings().setValue("mixerCpu", mixerCpu->value());
+  QSettings().setValue("renderCacheMB", renderCacheMB->value());
+  QSettings().setValue("renderCacheSpillMB", renderCacheSpillMB->value());
+  QSettings().setValue("exportLoops", exportLoops->isChecked());
+  QSettings().setValue("exportLoopCopies", exportLoopCopies->value());
+  QSettings().setValue("exportLoopFade", exportLoopFade->value());
+  QSettings().setValue("exportSilenceSeconds", exportSilenceSeconds->value());
+  QSettings().setValue("exportSilenceThreshold", exportSilenceThreshold->value());
+  QSettings().setValue("exportMaxSeconds", exportMaxSeconds->value());
+  QSettings().setValue("exportMaxWallSeconds", exportMaxWallSeconds->value());
+#ifdef HAVE_JACK
+  QSettings().setValue("jackBackend", jackBackend->isChecked());
+#endif
   accept();
 }
 
 void PreferencesWindow::updateEnabled()
 {
   maxLoopsPlaylist->setEnabled(!loopInfinitely->isChecked());
+  exportLoopCopies->setEnabled(exportLoops->isChecked());
+  exportLoopFade->setEnabled(exportLoops->isChecked() && exportLoopCopies->value() > 0);
+  exportSilenceThreshold->setEnabled(exportSilenceSeconds->value() > 0);
 }
@@ -18,9 +18,25 @@ private slots:
 
 private:
   QComboBox* cgbPolyphony;
+  QComboBox* latencyProfile;
+  QComboBox* exportSampleRate;
   QSpinBox* maxLoopsPlaylist;
   QCheckBox* loopInfinitely;
   QSpinBox* maxLoopsExport;
   QDoubleSpinBox* padSecondsStart;
   QDoubleSpinBox* padSecondsEnd;
+  QDoubleSpinBox* crossfadeSeconds;
+  QSpinBox* mixerCpu;
+  QSpinBox* renderCacheMB;
+  QSpinBox* renderCacheSpillMB;
+  QCheckBox* exportLoops;
+  QSpinBox* exportLoopCopies;
+  QDoubleSpinBox* exportLoopFade;
+  QDoubleSpinBox* exportSilenceSeconds;
+  QSpinBox* exportSilenceThreshold;
+  QSpinBox* exportMaxSeconds;
+  QSpinBox* exportMaxWallSeconds;
+#ifdef HAVE_JACK
+  QCheckBox* jackBackend;
+#endif
 };
@@ -0,0 +1,232 @@
+#include "RenderCache.h"
+#include "Debug.h"
+#include <QTemporaryFile>
+#include <QDir>
+#include <algorithm>
+#include <cstring>
+
+RenderCache::Entry::Entry(std::vector<sample>&& frames)
+: memory(std::move(frames)), mapped(nullptr), frameData(memory.data()), frameCount(memory.size())
+{
+}
+
+RenderCache::Entry::Entry(std::shared_ptr<QTemporaryFile> file, uchar* mapped, std::size_t frames)
+: file(file), mapped(mapped), frameData(reinterpret_cast<const sample*>(mapped)), frameCount(frames)
+{
+}
+
+RenderCache::Entry::~Entry()
+{
+  if (mapped) {
+    file->unmap(mapped);
+  }
+}
+
+RenderCache::RenderCache()
+: memoryBytes(0), spillBytes(0), memoryUsed(0), spillUsed(0)
+{
+}
+
+RenderCache::~RenderCache()
+{
+}
+
+void RenderCache::setLimits(std::size_t memory, std::size_t spill)
+{
+  memoryBytes = memory;
+  spillBytes = spill;
+  if (!isEnabled()) {
+    clear();
+  } else {
+    trim();
+  }
+}
+
+bool RenderCache::isEnabled() const
+{
+  return memoryBytes > 0;
+}
+
+std::size_t RenderCache::memoryLimit() const
+{
+  return memoryBytes;
+}
+
+std::shared_ptr<const RenderCache::Entry> RenderCache::find(const QString& key)
+{
+  for (auto it = slots.begin(); it != slots.end(); ++it) {
+    if (it->key == key) {
+      slots.splice(slots.begin(), slots, it);
+      Slot& slot = slots.front();
+      if (!slot.spilled) {
+        return slot.entry;
+      }
+      // Read it back here rather than let the mixer fault pages in from disk
+      // on its real-time thread. The copy is handed out even if it no longer
+      // fits the memory budget.
+      auto entry = std::make_shared<const Entry>(std::vector<sample>(slot.entry->data(), slot.entry->data() + slot.entry->frames()));
+      if (entry->bytes() <= memoryBytes) {
+        spillUsed -= slot.entry->bytes();
+        slot.entry = entry;
+        slot.spilled = false;
+        memoryUsed += entry->bytes();
+        trim();
+      }
+      return entry;
+    }
+  }
+  return nullptr;
+}
+
+void RenderCache::insert(const QString& key, std::vector<sample>&& frames)
+{
+  if (!isEnabled() || frames.empty() || frames.size() * sizeof(sample) > memoryBytes) {
+    return;
+  }
+  for (auto it = slots.begin(); it != slots.end(); ++it) {
+    if (it->key == key) {
+      (it->spilled ? spillUsed : memoryUsed) -= it->entry->bytes();
+      slots.erase(it);
+      break;
+    }
+  }
+  slots.push_front(Slot{ key, std::make_shared<const Entry>(std::move(frames)), false });
+  memoryUsed += slots.front().entry->bytes();
+  trim();
+}
+
+void RenderCache::clear()
+{
+  slots.clear();
+  memoryUsed = 0;
+  spillUsed = 0;
+  spillFile.reset();
+}
+
+void RenderCache::trim()
+{
+  // Starting with the least recently used entry, move entries out of memory
+  // until it fits the budget, then drop spilled ones over theirs.
+  auto it = slots.end();
+  while (it != slots.begin() && memoryUsed > memoryBytes) {
+    --it;
+    if (it->spilled) {
+      continue;
+    }
+    std::size_t bytes = it->entry->bytes();
+    memoryUsed -= bytes;
+    std::shared_ptr<const Entry> spilled = bytes <= spillBytes ? spill(*it->entry) : nullptr;
+    if (spilled) {
+      it->entry = spilled;
+      it->spilled = true;
+      spillUsed += bytes;
+    } else {
+      it = slots.erase(it);
+    }
+  }
+  it = slots.end();
+  while (it != slots.begin() && spillUsed > spillBytes) {
+    --it;
+    if (!it->spilled) {
+      continue;
+    }
+    spillUsed -= it->entry->bytes();
+    it = slots.erase(it);
+  }
+}
+
+std::shared_ptr<const RenderCache::Entry> RenderCache::spill(const Entry& entry)
+{
+  if (!spillFile || spillFile->size() > qint64(2 * spillBytes)) {
+    // The space of dropped entries isn't reused. Once enough has piled up,
+    // new entries go to a fresh file and the old one is deleted along with
+    // its last entry.
+    spillFile = std::make_shared<QTemporaryFile>(QDir::temp().filePath("agbplay-render-XXXXXX.cache"));
+    if (!spillFile->open()) {
+      Debug::print("Unable to create render cache file: %s", qPrintable(spillFile->errorString()));
+      spillFile.reset();
+      return nullptr;
+    }
+  }
+  qint64 offset = spillFile->size();
+  qint64 bytes = qint64(entry.bytes());
+  if (!spillFile->seek(offset) || spillFile->write(reinterpret_cast<const char*>(entry.data()), bytes) != bytes || !spillFile->flush()) {
+    Debug::print("Unable to write render cache file: %s", qPrintable(spillFile->errorString()));
+    return nullptr;
+  }
+  uchar* mapped = spillFile->map(offset, bytes);
+  if (!mapped) {
+    Debug::print("Unable to map render cache file: %s", qPrintable(spillFile->errorString()));
+    return nullptr;
+  }
+  return std::make_shared<const Entry>(spillFile, mapped, entry.frames());
+}
+
+RenderRecorder::RenderRecorder(const QString& key, std::size_t blockSize, std::size_t maxFrames)
+: cacheKey(key), blockSize(blockSize), maxFrames(maxFrames), queue(64, blockSize), finishing(false), ended(false), complete(false)
+{
+  setObjectName("render recorder");
+}
+
+RenderRecorder::~RenderRecorder()
+{
+  if (isRunning()) {
+    finish(false);
+    wait();
+  }
+}
+
+bool RenderRecorder::push(const sample* block)
+{
+  sample* slot = queue.writeSlot();
+  if (!slot) {
+    return false;
+  }
+  std::copy(block, block + blockSize, slot);
+  queue.push();
+  available.release();
+  return true;
+}
+
+void RenderRecorder::finish(bool songComplete)
+{
+  // only the first call counts
+  bool expected = false;
+  if (!finishing.compare_exchange_strong(expected, true)) {
+    return;
+  }
+  complete = songComplete;
+  ended = true;
+  available.release();
+}
+
+bool RenderRecorder::isComplete() const
+{
+  return complete && frames.size() <= maxFrames;
+}
+
+std::vector<sample> RenderRecorder::takeFrames()
+{
+  return std::move(frames);
+}
+
+void RenderRecorder::run()
+{
+  // every block and the end are announced with one release each
+  while (true) {
+    available.acquire();
+    if (const sample* block = queue.readSlot()) {
+      if (frames.size() + blockSize <= maxFrames) {
+        frames.insert(frames.end(), block, block + blockSize);
+      } else {
+        // too long to ever fit in the cache
+        frames.clear();
+        frames.shrink_to_fit();
+        maxFrames = 0;
+      }
+      queue.pop();
+    } else if (ended) {
+      break;
+    }
+  }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <QThread>
+#include <QSemaphore>
+#include <QString>
+#include <list>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include "BlockQueue.h"
+#include "Types.h"
+class QTemporaryFile;
+
+// Bounded LRU cache of rendered master audio at the engine's rate, keyed by
+// ROM, song and engine configuration. Entries are immutable, so the mixer
+// can keep playing one after it has been evicted. Entries pushed out of the
+// memory budget move to a memory-mapped spill file if one is allowed, and
+// are read back into memory when they are found again, so the mixer only
+// ever plays from RAM. Only used from the GUI thread.
+class RenderCache
+{
+public:
+  class Entry
+  {
+  public:
+    Entry(std::vector<sample>&& frames);
+    Entry(std::shared_ptr<QTemporaryFile> file, uchar* mapped, std::size_t frames);
+    ~Entry();
+
+    const sample* data() const { return frameData; }
+    std::size_t frames() const { return frameCount; }
+    std::size_t bytes() const { return frameCount * sizeof(sample); }
+
+  private:
+    std::vector<sample> memory;
+    std::shared_ptr<QTemporaryFile> file;
+    uchar* mapped;
+    const sample* frameData;
+    std::size_t frameCount;
+  };
+
+  RenderCache();
+  ~RenderCache();
+
+  void setLimits(std::size_t memoryBytes, std::size_t spillBytes);
+  bool isEnabled() const;
+  std::size_t memoryLimit() const;
+
+  std::shared_ptr<const Entry> find(const QString& key);
+  void insert(const QString& key, std::vector<sample>&& frames);
+  void clear();
+
+private:
+  struct Slot {
+    QString key;
+    std::shared_ptr<const Entry> entry;
+    bool spilled;
+  };
+
+  void trim();
+  std::shared_ptr<const Entry> spill(const Entry& entry);
+
+  // most recently used first
+  std::list<Slot> slots;
+  std::size_t memoryBytes, spillBytes;
+  std::size_t memoryUsed, spillUsed;
+  std::shared_ptr<QTemporaryFile> spillFile;
+};
+
+// Collects a song's master output on a helper thread while the mixer plays
+// it. The mixer only copies each block into a preallocated queue; the helper
+// does the allocating.
+class RenderRecorder : public QThread
+{
+public:
+  RenderRecorder(const QString& key, std::size_t blockSize, std::size_t maxFrames);
+  ~RenderRecorder();
+
+  const QString& key() const { return cacheKey; }
+
+  // called from the mixer thread, or finish() from the GUI once the mixer
+  // is gone
+  bool push(const sample* block);
+  void finish(bool complete);
+
+  // only valid once the thread has finished
+  bool isComplete() const;
+  std::vector<sample> takeFrames();
+
+protected:
+  virtual void run() override;
+
+private:
+  QString cacheKey;
+  std::size_t blockSize, maxFrames;
+  BlockQueue queue;
+  QSemaphore available;
+  std::atomic<bool> finishing, ended, complete;
+  std::vector<sample> frames;
+};
@@ -1,4 +1,6 @@
 #include "RiffWriter.h"
+#include <algorithm>
+#include <cmath>
 
 template <typename T>
 static void writeLE(QIODevice& file, T data)
@@ -12,7 +14,7 @@ static void writeLE(QIODevice& file, T data)
 }
 
 RiffWriter::RiffWriter(uint32_t sampleRate, bool stereo, uint32_t size)
-: sampleRate(sampleRate), size(size), stereo(stereo), rewriteSize(!size)
+: sampleRate(sampleRate), size(size), stereo(stereo), rewriteSize(!size), hasLoop(false), loopStart(0), loopEnd(0)
 {
   // initializers only
 }
@@ -25,7 +27,8 @@ RiffWriter::~RiffWriter()
 bool RiffWriter::open(const QString& filename)
 {
   file.setFileName(filename);
-  bool ok = file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+  // readable so that loops can be copied from what was written
+  bool ok = file.open(QIODevice::ReadWrite | QIODevice::Truncate);
   if (!ok) {
     return false;
   }
@@ -73,15 +76,120 @@ void RiffWriter::write(const std::vector<int16_t>& left, const std::vector<int16
   }
 }
 
+void RiffWriter::write(const int16_t* left, const int16_t* right, size_t words)
+{
+  if (rewriteSize) {
+    size += std::uint32_t(words * 4);
+  }
+  for (std::size_t i = 0; i < words; i++) {
+    writeLE<int16_t>(file, left[i]);
+    writeLE<int16_t>(file, right[i]);
+  }
+}
+
+uint32_t RiffWriter::frames() const
+{
+  return size / (stereo ? 4 : 2);
+}
+
+bool RiffWriter::read(uint32_t start, uint32_t count, int16_t* left, int16_t* right)
+{
+  static constexpr uint32_t chunkFrames = 4096;
+  if (!stereo || start + count > frames()) {
+    return false;
+  }
+  char bytes[chunkFrames * 4];
+  bool ok = file.seek(dataOffset + qint64(start) * 4);
+  for (uint32_t done = 0; ok && done < count;) {
+    uint32_t chunk = std::min(chunkFrames, count - done);
+    ok = file.read(bytes, chunk * 4) == qint64(chunk) * 4;
+    for (uint32_t i = 0; ok && i < chunk; i++) {
+      const unsigned char* frame = reinterpret_cast<const unsigned char*>(&bytes[i * 4]);
+      left[done + i] = int16_t(frame[0] | (frame[1] << 8));
+      right[done + i] = int16_t(frame[2] | (frame[3] << 8));
+    }
+    done += chunk;
+  }
+  // later writes append again
+  return file.seek(dataOffset + qint64(size)) && ok;
+}
+
+bool RiffWriter::truncate(uint32_t count)
+{
+  if (!rewriteSize || count > frames()) {
+    return false;
+  }
+  size = count * (stereo ? 4 : 2);
+  return file.resize(dataOffset + qint64(size)) && file.seek(dataOffset + qint64(size));
+}
+
+bool RiffWriter::appendLoop(uint32_t start, uint32_t length, uint32_t count, float gainStart, float gainEnd)
+{
+  static constexpr uint32_t chunkFrames = 4096;
+  if (length == 0 || start + length > frames()) {
+    return false;
+  }
+  std::vector<int16_t> left(chunkFrames), right(chunkFrames);
+  uint32_t source = start;
+  for (uint32_t done = 0; done < count;) {
+    uint32_t chunk = std::min({ chunkFrames, count - done, start + length - source });
+    if (!read(source, chunk, left.data(), right.data())) {
+      return false;
+    }
+    for (uint32_t i = 0; i < chunk; i++) {
+      float gain = gainStart + (gainEnd - gainStart) * float(done + i) / float(count);
+      left[i] = int16_t(std::lround(left[i] * gain));
+      right[i] = int16_t(std::lround(right[i] * gain));
+    }
+    write(left.data(), right.data(), chunk);
+    done += chunk;
+    source += chunk;
+    if (source == start + length) {
+      source = start;
+    }
+  }
+  return true;
+}
+
+void RiffWriter::setLoop(uint32_t start, uint32_t end)
+{
+  hasLoop = true;
+  loopStart = start;
+  loopEnd = end;
+}
+
 void RiffWriter::close()
 {
   if (!file.isOpen()) {
     return;
   }
-  if (rewriteSize) {
+  uint32_t extra = 0;
+  if (hasLoop) {
+    // smpl chunk with a single forward loop that repeats forever
+    file.seek(dataOffset + qint64(size));
+    file.write("smpl", 4);
+    writeLE<uint32_t>(file, 60);
+    writeLE<uint32_t>(file, 0);      // manufacturer
+    writeLE<uint32_t>(file, 0);      // product
+    writeLE<uint32_t>(file, uint32_t(1000000000.0 / sampleRate));
+    writeLE<uint32_t>(file, 60);     // MIDI unity note
+    writeLE<uint32_t>(file, 0);      // pitch fraction
+    writeLE<uint32_t>(file, 0);      // SMPTE format
+    writeLE<uint32_t>(file, 0);      // SMPTE offset
+    writeLE<uint32_t>(file, 1);      // loop count
+    writeLE<uint32_t>(file, 0);      // sampler data
+    writeLE<uint32_t>(file, 0);      // cue point id
+    writeLE<uint32_t>(file, 0);      // forward loop
+    writeLE<uint32_t>(file, loopStart);
+    writeLE<uint32_t>(file, loopEnd);
+    writeLE<uint32_t>(file, 0);      // fraction
+    writeLE<uint32_t>(file, 0);      // play count, 0 is infinite
+    extra = 68;
+  }
+  if (rewriteSize || hasLoop) {
     bool ok = file.seek(4);
     if (ok) {
-      writeLE(file, size + 36);
+      writeLE(file, size + 36 + extra);
       file.seek(file.pos() + 32);
       writeLE(file, size);
     }
@@ -21,10 +21,30 @@ public:
     { write(data.data(), data.size()); }
   void write(const std::vector<int16_t>& data);
   void write(const std::vector<int16_t>& left, const std::vector<int16_t>& right);
+  void write(const int16_t* left, const int16_t* right, size_t words);
   void close();
 
+  // Reading back and rewriting what was written, for stereo files whose size
+  // wasn't given up front. Frames are counted from the start of the data.
+  uint32_t frames() const;
+  bool read(uint32_t start, uint32_t count, int16_t* left, int16_t* right);
+  bool truncate(uint32_t count);
+
+  // Appends count frames copied from audio already written, repeating the
+  // frames in [start, start + length) and ramping the gain from gainStart to
+  // gainEnd.
+  bool appendLoop(uint32_t start, uint32_t length, uint32_t count, float gainStart, float gainEnd);
+
+  // Adds a smpl chunk with one forward loop from start to end, inclusive,
+  // when the file is closed.
+  void setLoop(uint32_t start, uint32_t end);
+
 private:
+  static constexpr qint64 dataOffset = 44;
+
   QFile file;
   uint32_t sampleRate, size;
   bool stereo, rewriteSize;
+  bool hasLoop;
+  uint32_t loopStart, loopEnd;
 };
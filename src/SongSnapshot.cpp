@@ -0,0 +1,67 @@
+#include "SongSnapshot.h"
+#include "PlayerContext.h"
+#include "VUMeter.h"
+#include <cmath>
+
+static bool levelMoved(const sample& a, const sample& b)
+{
+  static constexpr float threshold = 1.0f / 512.0f;
+  return std::fabs(a.left - b.left) > threshold || std::fabs(a.right - b.right) > threshold;
+}
+
+SongSnapshot::SongSnapshot()
+: numTracks(0), master{0.0f, 0.0f}
+{
+  // initializers only
+}
+
+void SongSnapshot::capture(const PlayerContext* ctx, const VUState* vu)
+{
+  if (!ctx) {
+    numTracks = 0;
+    master = sample{0.0f, 0.0f};
+    return;
+  }
+
+  numTracks = int(ctx->seq.tracks.size());
+  if (numTracks > maxTracks) {
+    numTracks = maxTracks;
+  }
+  int numMeters = int(vu->loudness.size());
+  vu->masterLoudness.getLevel(master.left, master.right);
+  for (int i = 0; i < numTracks; i++) {
+    const auto& track = ctx->seq.tracks[i];
+    TrackSnapshot& t = tracks[i];
+    t.pos = std::uint32_t(track.pos);
+    t.vol = track.vol;
+    t.mod = track.mod;
+    t.prog = track.prog;
+    t.pan = track.pan;
+    t.pitch = track.pitch;
+    t.delay = track.delay;
+    t.muted = track.muted;
+    t.activeNotes = track.activeNotes;
+    if (i < numMeters) {
+      vu->loudness[i].getLevel(t.level.left, t.level.right);
+    } else {
+      t.level = sample{0.0f, 0.0f};
+    }
+  }
+}
+
+bool SongSnapshot::differsVisibly(const SongSnapshot& other) const
+{
+  if (numTracks != other.numTracks || levelMoved(master, other.master)) {
+    return true;
+  }
+  for (int i = 0; i < numTracks; i++) {
+    const TrackSnapshot& a = tracks[i];
+    const TrackSnapshot& b = other.tracks[i];
+    if (a.pos != b.pos || a.vol != b.vol || a.mod != b.mod || a.prog != b.prog ||
+        a.pan != b.pan || a.pitch != b.pitch || a.delay != b.delay || a.muted != b.muted ||
+        a.activeNotes != b.activeNotes || levelMoved(a.level, b.level)) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include "Types.h"
+class PlayerContext;
+struct VUState;
+
+struct TrackSnapshot
+{
+  std::uint32_t pos;
+  int vol;
+  int mod;
+  int prog;
+  int pan;
+  int pitch;
+  int delay;
+  bool muted;
+  std::bitset<128> activeNotes;
+  sample level;
+};
+
+// Copy of everything the GUI displays about the playing song, captured by
+// whichever thread currently owns the PlayerContext.
+struct SongSnapshot
+{
+  static constexpr int maxTracks = 16;
+
+  SongSnapshot();
+
+  void capture(const PlayerContext* ctx, const VUState* vu);
+
+  // True if painting this snapshot would look different from other. Level
+  // changes too small to move a meter don't count.
+  bool differsVisibly(const SongSnapshot& other) const;
+
+  int numTracks;
+  sample master;
+  TrackSnapshot tracks[maxTracks];
+};
@@ -0,0 +1,183 @@
+#include "ThreadPriority.h"
+#include "OS.h"
+#include "Debug.h"
+
+#if defined(_WIN32)
+
+#include <windows.h>
+#include <avrt.h>
+
+// the calling thread's MMCSS task, if it joined one
+static thread_local HANDLE mmcssTask = nullptr;
+
+bool ThreadPriority::raiseToRealtime()
+{
+  // MMCSS boosts the thread the same way the Windows audio stack does for
+  // its own threads.
+  DWORD taskIndex = 0;
+  mmcssTask = AvSetMmThreadCharacteristicsW(L"Pro Audio", &taskIndex);
+  if (mmcssTask) {
+    Debug::print("Mixer thread: MMCSS \"Pro Audio\" task");
+    return true;
+  }
+  Debug::print("AvSetMmThreadCharacteristics() failed with error %lu", GetLastError());
+  if (SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+    Debug::print("Mixer thread: time critical priority");
+    return true;
+  }
+  return false;
+}
+
+void ThreadPriority::leaveRealtime()
+{
+  if (mmcssTask) {
+    if (!AvRevertMmThreadCharacteristics(mmcssTask)) {
+      Debug::print("AvRevertMmThreadCharacteristics() failed with error %lu", GetLastError());
+    }
+    mmcssTask = nullptr;
+  }
+}
+
+bool ThreadPriority::pinToCpu(int cpu)
+{
+  if (cpu < 0 || cpu >= int(sizeof(DWORD_PTR) * 8)) {
+    return false;
+  }
+  if (!SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu)) {
+    Debug::print("SetThreadAffinityMask() failed with error %lu", GetLastError());
+    return false;
+  }
+  return true;
+}
+
+#elif __has_include(<unistd.h>)
+
+#include <pthread.h>
+#include <sched.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#if defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <csignal>
+#endif
+#ifdef HAVE_RTKIT
+#include <QDBusInterface>
+#include <QDBusReply>
+#endif
+
+// high enough to preempt ordinary threads, low enough to leave room for the
+// sound server's own threads, which usually run at 20 and up
+static constexpr int realtimePriority = 10;
+
+#ifdef HAVE_RTKIT
+static void warnRealtimeLimit(int)
+{
+  static const char message[] = "agbplay: a real-time thread ran too long without blocking and will be killed if it goes on\n";
+  ssize_t written = write(STDERR_FILENO, message, sizeof(message) - 1);
+  (void)written;
+}
+
+// Desktop systems rarely grant RLIMIT_RTPRIO to users, but RealtimeKit hands
+// out real-time scheduling on request over D-Bus.
+static bool makeRealtimeWithRtkit(int priority)
+{
+  QDBusInterface rtkit("org.freedesktop.RealtimeKit1", "/org/freedesktop/RealtimeKit1",
+    "org.freedesktop.RealtimeKit1", QDBusConnection::systemBus());
+  if (!rtkit.isValid()) {
+    return false;
+  }
+  int maxPriority = rtkit.property("MaxRealtimePriority").toInt();
+  if (maxPriority > 0) {
+    priority = std::min(priority, maxPriority);
+  }
+  // RealtimeKit only serves processes whose hard limit on real-time CPU time
+  // without blocking is within its own. This applies to every real-time
+  // thread of the process. Exceeding the soft limit, set at half of that,
+  // raises SIGXCPU, which is logged instead of ending the process, before
+  // the hard limit kills it.
+  qlonglong maxTime = rtkit.property("RTTimeUSecMax").toLongLong();
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_RTTIME, &limit) == 0 && (limit.rlim_max == RLIM_INFINITY || limit.rlim_max > rlim_t(maxTime))) {
+    limit.rlim_max = maxTime > 0 ? rlim_t(maxTime) : 200000;
+    limit.rlim_cur = limit.rlim_max / 2;
+    setrlimit(RLIMIT_RTTIME, &limit);
+    struct sigaction action;
+    if (sigaction(SIGXCPU, nullptr, &action) == 0 && action.sa_handler == SIG_DFL) {
+      std::memset(&action, 0, sizeof(action));
+      action.sa_handler = warnRealtimeLimit;
+      sigemptyset(&action.sa_mask);
+      sigaction(SIGXCPU, &action, nullptr);
+    }
+  }
+  QDBusReply<void> reply = rtkit.call("MakeThreadRealtime", quint64(syscall(SYS_gettid)), quint32(priority));
+  if (!reply.isValid()) {
+    Debug::print("RealtimeKit: %s", qPrintable(reply.error().message()));
+    return false;
+  }
+  return true;
+}
+#endif
+
+bool ThreadPriority::raiseToRealtime()
+{
+  sched_param param;
+  std::memset(&param, 0, sizeof(param));
+  param.sched_priority = std::max(sched_get_priority_min(SCHED_FIFO), realtimePriority);
+  int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+#ifdef HAVE_RTKIT
+  if (err == EPERM && makeRealtimeWithRtkit(param.sched_priority)) {
+    err = 0;
+  }
+#endif
+  if (err != 0) {
+    Debug::print("Mixer thread: real-time scheduling unavailable: %s", std::strerror(err));
+    return false;
+  }
+#if defined(__linux__)
+  // the thread id is what 'chrt -p' expects
+  Debug::print("Mixer thread %ld: SCHED_FIFO priority %d", long(syscall(SYS_gettid)), param.sched_priority);
+#else
+  Debug::print("Mixer thread: SCHED_FIFO priority %d", param.sched_priority);
+#endif
+  return true;
+}
+
+void ThreadPriority::leaveRealtime()
+{
+  // the scheduling policy ends with the thread
+}
+
+bool ThreadPriority::pinToCpu(int cpu)
+{
+#if defined(__linux__)
+  if (cpu < 0 || cpu >= CPU_SETSIZE) {
+    return false;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (err != 0) {
+    Debug::print("pthread_setaffinity_np(): unable to pin thread to CPU %d: %s", cpu, std::strerror(err));
+    return false;
+  }
+  return true;
+#else
+  // macOS and the BSDs only offer affinity hints, which aren't worth it here
+  (void)cpu;
+  return false;
+#endif
+}
+
+#else
+// Unsupported OS
+#error "Apparently your OS is neither Windows nor appears to be a UNIX variant (no unistd.h). You will have to add support for your OS in src/ThreadPriority.cpp :/"
+#endif
+
+void ThreadPriority::lower()
+{
+  OS::LowerThreadPriority();
+}
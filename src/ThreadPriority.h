@@ -0,0 +1,28 @@
+#pragma once
+
+// Scheduling for the audio threads. Everything here acts on the calling
+// thread and fails softly: without the necessary rights the thread keeps
+// running at normal priority and the reason is written to the debug log.
+namespace ThreadPriority {
+  // Real-time scheduling for the thread that feeds the audio device, using
+  // SCHED_FIFO where permitted, RealtimeKit as a fallback on Linux, or MMCSS
+  // on Windows.
+  //
+  // A real-time thread must block, normally on the device, at least every
+  // few blocks. Anything longer, such as rendering far ahead, has to be done
+  // in slices between blocks or on a normal thread. Otherwise it starves
+  // everything else on its CPU. With RealtimeKit the process also gets
+  // RLIMIT_RTTIME: SIGXCPU after about 100 ms without blocking and SIGKILL
+  // after RealtimeKit's maximum, usually 200 ms.
+  bool raiseToRealtime();
+
+  // Undoes raiseToRealtime() before the thread exits. Only MMCSS needs this,
+  // since its task handle outlives the thread otherwise.
+  void leaveRealtime();
+
+  // Restricts the calling thread to a single CPU.
+  bool pinToCpu(int cpu);
+
+  // Background rendering such as exports, so it can't starve playback.
+  void lower();
+}
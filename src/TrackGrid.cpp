@@ -0,0 +1,331 @@
+#include "TrackGrid.h"
+#include "TrackHeader.h"
+#include "VUMeter.h"
+#include "UiUtils.h"
+#include <QPainter>
+#include <QPaintEvent>
+#include <QMouseEvent>
+#include <QStyle>
+#include <QStyleOptionButton>
+#include <algorithm>
+
+static double meterLevel(float level)
+{
+  double v = level * 3;
+  return v > 1.0 ? 1.0 : v;
+}
+
+TrackGrid::TrackGrid(TrackHeader* header, QWidget* parent)
+: QWidget(parent), header(header), vuWidth(0), pressedTrack(-1), pressedBox(NoBox)
+{
+  QSize panel = header->sizeHint();
+  panelWidth = panel.width();
+  rowHeight = panel.height();
+  keysHeight = header->mute.height();
+  int spacing = style()->pixelMetric(QStyle::PM_LayoutVerticalSpacing, nullptr, this);
+  rowPitch = rowHeight + (spacing < 0 ? 2 : spacing);
+
+  setSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::MinimumExpanding);
+  setMaximumWidth(panelWidth + PianoKeys::maximumWidth() + 2);
+  rows.reserve(SongSnapshot::maxTracks);
+}
+
+QSize TrackGrid::sizeHint() const
+{
+  // an empty grid still reserves one row so the list has a sensible height
+  int numRows = rows.isEmpty() ? 1 : rows.size();
+  return QSize(453 + panelWidth, numRows * rowPitch);
+}
+
+QSize TrackGrid::minimumSizeHint() const
+{
+  return QSize(panelWidth + PianoKeys::minimumWidth() + 2, rows.size() * rowPitch);
+}
+
+void TrackGrid::setTrackCount(int numTracks)
+{
+  // Rows are reset in place and the vector keeps its capacity, so skimming
+  // through songs doesn't reallocate anything. Only a change in the number
+  // of rows needs a new layout.
+  int oldCount = rows.size();
+  int kept = std::min(oldCount, numTracks);
+  for (int i = 0; i < kept; i++) {
+    rows[i] = Row();
+  }
+  rows.resize(numTracks);
+  pressedTrack = -1;
+  pressedBox = NoBox;
+  if (numTracks != oldCount) {
+    updateGeometry();
+  }
+  update(QRect(0, 0, width(), std::max(oldCount, numTracks) * rowPitch));
+}
+
+int TrackGrid::trackCount() const
+{
+  return rows.size();
+}
+
+QRect TrackGrid::rowRect(int track) const
+{
+  return QRect(0, track * rowPitch, width(), rowHeight);
+}
+
+QRect TrackGrid::cellRect(int track, const QRect& column) const
+{
+  return column.translated(0, track * rowPitch);
+}
+
+QRect TrackGrid::keysRect(int track) const
+{
+  return QRect(QPoint(panelWidth, track * rowPitch), keys.size());
+}
+
+QRect TrackGrid::vuRect(int track) const
+{
+  return QRect(panelWidth, track * rowPitch + keysHeight + 1, vuWidth, rowHeight - keysHeight - 1);
+}
+
+void TrackGrid::resizeEvent(QResizeEvent* e)
+{
+  QWidget::resizeEvent(e);
+  updateLayout();
+}
+
+void TrackGrid::changeEvent(QEvent* e)
+{
+  QWidget::changeEvent(e);
+  if (e->type() == QEvent::PaletteChange) {
+    updateLayout();
+    update();
+  }
+}
+
+void TrackGrid::updateLayout()
+{
+  int keysWidth = std::clamp(width() - panelWidth - 2, PianoKeys::minimumWidth(), PianoKeys::maximumWidth());
+  keys.resize(QSize(keysWidth, keysHeight), devicePixelRatioF(), palette());
+  vuWidth = PianoKeys::preferredWidth(keysWidth);
+  VUMeter::makeGradients(vuWidth, Qt::Horizontal, false, &leftGradient, &rightGradient);
+  VUMeter::makeGradients(vuWidth, Qt::Horizontal, true, &mutedLeftGradient, &mutedRightGradient);
+}
+
+void TrackGrid::updateTracks(const SongSnapshot* snapshot)
+{
+  // a snapshot from the previous song may still be pending after a song change
+  int numTracks = std::min(rows.size(), snapshot->numTracks);
+  for (int i = 0; i < numTracks; i++) {
+    updateRow(i, snapshot->tracks[i]);
+  }
+}
+
+void TrackGrid::updateRow(int track, const TrackSnapshot& state)
+{
+  Row& row = rows[track];
+  const TrackSnapshot& old = row.shown;
+  bool all = !row.hasShown;
+
+  // only invalidate the cells whose values differ from the last frame
+  if (all || state.pos != old.pos) {
+    update(cellRect(track, header->location));
+  }
+  if (all || state.vol != old.vol) {
+    update(cellRect(track, header->volume));
+  }
+  if (all || state.mod != old.mod) {
+    update(cellRect(track, header->mod));
+  }
+  if (all || state.prog != old.prog) {
+    update(cellRect(track, header->program));
+  }
+  if (all || state.pitch != old.pitch) {
+    update(cellRect(track, header->pitch));
+  }
+  if (all || state.pan != old.pan) {
+    update(cellRect(track, header->pan));
+  }
+  if (all || std::max(0, state.delay) != std::max(0, old.delay)) {
+    update(cellRect(track, header->delay));
+  }
+
+  QRect keyArea = keysRect(track);
+  if (all) {
+    update(keyArea);
+  } else {
+    std::bitset<128> changed = state.activeNotes ^ old.activeNotes;
+    if (changed.any()) {
+      for (int i = 0; i < 128; i++) {
+        if (changed[i]) {
+          update(keys.keyRect(i).adjusted(0, 0, 1, 1).translated(keyArea.topLeft()));
+        }
+      }
+    }
+  }
+
+  bool vuChanged = all || state.muted != old.muted;
+  if (!vuChanged) {
+    vuChanged = VUMeter::levelExtent(vuWidth, Qt::Horizontal, meterLevel(state.level.left)) != VUMeter::levelExtent(vuWidth, Qt::Horizontal, meterLevel(old.level.left)) ||
+      VUMeter::levelExtent(vuWidth, Qt::Horizontal, meterLevel(state.level.right)) != VUMeter::levelExtent(vuWidth, Qt::Horizontal, meterLevel(old.level.right));
+  }
+  if (vuChanged) {
+    update(vuRect(track));
+  }
+
+  if (all || state.muted != old.muted) {
+    row.mute = state.muted;
+    if (state.muted) {
+      row.solo = false;
+    }
+    update(cellRect(track, header->mute));
+    update(cellRect(track, header->solo));
+  }
+
+  row.shown = state;
+  row.hasShown = true;
+}
+
+void TrackGrid::clearSolo()
+{
+  int numTracks = rows.size();
+  for (int i = 0; i < numTracks; i++) {
+    if (rows[i].solo) {
+      rows[i].solo = false;
+      update(cellRect(i, header->solo));
+    }
+  }
+}
+
+void TrackGrid::paintEvent(QPaintEvent* e)
+{
+  QRect dirty = e->rect();
+  int first = std::max(0, dirty.top() / rowPitch);
+  int last = std::min(rows.size() - 1, dirty.bottom() / rowPitch);
+
+  QPainter p(this);
+  for (int i = first; i <= last; i++) {
+    if (rowRect(i).intersects(dirty)) {
+      paintRow(&p, i, dirty);
+    }
+  }
+}
+
+void TrackGrid::paintRow(QPainter* p, int track, const QRect& dirty)
+{
+  const Row& row = rows[track];
+  const TrackSnapshot& state = row.shown;
+
+  p->setPen(palette().color(QPalette::WindowText));
+  auto drawCell = [&](const QRect& column, const QString& text) {
+    QRect cell = cellRect(track, column);
+    if (cell.intersects(dirty)) {
+      p->drawText(cell, Qt::AlignCenter, text);
+    }
+  };
+  drawCell(header->trackNumber, fixedNumber(track, 2));
+  drawCell(header->location, formatAddress(state.pos));
+  drawCell(header->delay, "W" + fixedNumber(std::max(0, state.delay), 2));
+  drawCell(header->program, QString::number(state.prog));
+  drawCell(header->pan, signedNumber(state.pan));
+  drawCell(header->volume, QString::number(state.vol));
+  drawCell(header->mod, QString::number(state.mod));
+  drawCell(header->pitch, signedNumber(state.pitch));
+
+  QRect muteRect = cellRect(track, header->mute);
+  if (muteRect.intersects(dirty)) {
+    paintCheckBox(p, muteRect, TrackHeader::tr("M"), row.mute);
+  }
+  QRect soloRect = cellRect(track, header->solo);
+  if (soloRect.intersects(dirty)) {
+    paintCheckBox(p, soloRect, TrackHeader::tr("S"), row.solo);
+  }
+
+  QRect keyArea = keysRect(track);
+  if (keyArea.intersects(dirty)) {
+    keys.paint(p, keyArea.topLeft(), dirty.translated(-keyArea.topLeft()), state.activeNotes);
+  }
+
+  QRect vuArea = vuRect(track);
+  if (vuArea.intersects(dirty)) {
+    p->save();
+    p->translate(vuArea.topLeft());
+    VUMeter::paintLevels(
+      p,
+      vuArea.size(),
+      Qt::Horizontal,
+      meterLevel(state.level.left),
+      meterLevel(state.level.right),
+      row.mute ? mutedLeftGradient : leftGradient,
+      row.mute ? mutedRightGradient : rightGradient
+    );
+    p->restore();
+  }
+}
+
+void TrackGrid::paintCheckBox(QPainter* p, const QRect& rect, const QString& text, bool on)
+{
+  QStyleOptionButton opt;
+  opt.initFrom(this);
+  opt.rect = rect;
+  opt.text = text;
+  opt.state |= on ? QStyle::State_On : QStyle::State_Off;
+  style()->drawControl(QStyle::CE_CheckBox, &opt, p, this);
+}
+
+int TrackGrid::trackAt(const QPoint& pos) const
+{
+  int track = pos.y() / rowPitch;
+  if (pos.y() < 0 || track >= rows.size() || !rowRect(track).contains(pos)) {
+    return -1;
+  }
+  return track;
+}
+
+TrackGrid::Box TrackGrid::boxAt(const QPoint& pos, int track) const
+{
+  if (track < 0) {
+    return NoBox;
+  } else if (cellRect(track, header->mute).contains(pos)) {
+    return MuteBox;
+  } else if (cellRect(track, header->solo).contains(pos)) {
+    return SoloBox;
+  }
+  return NoBox;
+}
+
+void TrackGrid::mousePressEvent(QMouseEvent* e)
+{
+  if (e->button() != Qt::LeftButton) {
+    QWidget::mousePressEvent(e);
+    return;
+  }
+  pressedTrack = trackAt(e->pos());
+  pressedBox = boxAt(e->pos(), pressedTrack);
+}
+
+void TrackGrid::mouseReleaseEvent(QMouseEvent* e)
+{
+  if (e->button() != Qt::LeftButton) {
+    QWidget::mouseReleaseEvent(e);
+    return;
+  }
+  int track = trackAt(e->pos());
+  Box box = boxAt(e->pos(), track);
+  bool clicked = box != NoBox && track == pressedTrack && box == pressedBox;
+  pressedTrack = -1;
+  pressedBox = NoBox;
+  if (!clicked) {
+    return;
+  }
+
+  Row& row = rows[track];
+  if (box == MuteBox) {
+    row.mute = !row.mute;
+    update(cellRect(track, header->mute));
+    update(vuRect(track));
+    emit muteToggled(track, row.mute);
+  } else {
+    row.solo = !row.solo;
+    update(cellRect(track, header->solo));
+    emit soloToggled(track, row.solo);
+  }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <QWidget>
+#include <QVector>
+#include <QBrush>
+#include "PianoKeys.h"
+#include "SongSnapshot.h"
+class TrackHeader;
+
+// Draws every track row with one paint routine, using the column geometry
+// calculated by TrackHeader. Mute and solo boxes are hit-tested here.
+class TrackGrid : public QWidget
+{
+Q_OBJECT
+public:
+  TrackGrid(TrackHeader* header, QWidget* parent = nullptr);
+
+  QSize sizeHint() const;
+  QSize minimumSizeHint() const;
+
+  void setTrackCount(int tracks);
+  int trackCount() const;
+  QRect rowRect(int track) const;
+
+  void updateTracks(const SongSnapshot* snapshot);
+  void clearSolo();
+
+signals:
+  void muteToggled(int track, bool on);
+  void soloToggled(int track, bool on);
+
+protected:
+  void paintEvent(QPaintEvent*);
+  void resizeEvent(QResizeEvent*);
+  void changeEvent(QEvent*);
+  void mousePressEvent(QMouseEvent*);
+  void mouseReleaseEvent(QMouseEvent*);
+
+private:
+  enum Box { NoBox, MuteBox, SoloBox };
+
+  struct Row {
+    TrackSnapshot shown = TrackSnapshot();
+    bool hasShown = false;
+    bool mute = false;
+    bool solo = false;
+  };
+
+  QRect cellRect(int track, const QRect& column) const;
+  QRect keysRect(int track) const;
+  QRect vuRect(int track) const;
+  int trackAt(const QPoint& pos) const;
+  Box boxAt(const QPoint& pos, int track) const;
+  void updateRow(int track, const TrackSnapshot& state);
+  void paintRow(QPainter* p, int track, const QRect& dirty);
+  void paintCheckBox(QPainter* p, const QRect& rect, const QString& text, bool on);
+  void updateLayout();
+
+  TrackHeader* header;
+  QVector<Row> rows;
+  PianoKeys keys;
+  QBrush leftGradient, rightGradient, mutedLeftGradient, mutedRightGradient;
+
+  int panelWidth;
+  int rowHeight;
+  int rowPitch;
+  int keysHeight;
+  int vuWidth;
+
+  int pressedTrack;
+  Box pressedBox;
+};
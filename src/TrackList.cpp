@@ -1,31 +1,22 @@
 #include "TrackList.h"
 #include "TrackHeader.h"
-#include "TrackView.h"
+#include "TrackGrid.h"
 #include "PlayerContext.h"
-#include "VUMeter.h"
+#include "SongSnapshot.h"
 #include "UiUtils.h"
-#include <QVBoxLayout>
 #include <QScrollBar>
-#include <QLabel>
 #include <QEvent>
+#include <QTimer>
 
 TrackList::TrackList(QWidget* parent)
-: QScrollArea(parent)
+: QScrollArea(parent), lastVisibleTracks(0)
 {
-  base = new QWidget(this);
-  setWidget(base);
-  setWidgetResizable(true);
-
-  trackLayout = new QVBoxLayout(base);
-  trackLayout->setContentsMargins(0, 0, 0, 0);
   header = new TrackHeader(this);
   header->setTrackName("");
 
-  // populate a dummy entry for geometry
-  TrackView* v = new TrackView(header, 0, base);
-  tracks << v;
-  trackLayout->addWidget(v, 0);
-  trackLayout->addStretch(1);
+  grid = new TrackGrid(header, this);
+  setWidget(grid);
+  setWidgetResizable(true);
 
   header->setGeometry(1, 1, width() - 2, header->sizeHint().height());
   setViewportMargins(0, header->sizeHint().height() + 1, 0, 0);
@@ -33,14 +24,19 @@ TrackList::TrackList(QWidget* parent)
   setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOn);
   setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
   setSizeAdjustPolicy(QScrollArea::AdjustToContentsOnFirstShow);
-  setMaximumWidth(v->maximumWidth() + verticalScrollBar()->sizeHint().width());
+  setMaximumWidth(grid->maximumWidth() + verticalScrollBar()->sizeHint().width());
+
+  QObject::connect(grid, SIGNAL(muteToggled(int,bool)), this, SLOT(onMuteToggled(int,bool)));
+  QObject::connect(grid, SIGNAL(soloToggled(int,bool)), this, SLOT(soloToggled(int,bool)));
+  QObject::connect(verticalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(updateVisibleTracks()));
+  QObject::connect(verticalScrollBar(), SIGNAL(rangeChanged(int,int)), this, SLOT(updateVisibleTracks()));
 }
 
 QSize TrackList::sizeHint() const
 {
   return QSize(
-    base->sizeHint().width() + verticalScrollBar()->sizeHint().width() + 20,
-    base->sizeHint().height() + 4
+    grid->sizeHint().width() + verticalScrollBar()->sizeHint().width() + 20,
+    grid->sizeHint().height() + 4
   );
 }
 
@@ -48,67 +44,70 @@ void TrackList::showEvent(QShowEvent* e)
 {
   QScrollArea::showEvent(e);
   setMinimumWidth(sizeHint().width());
-  setMinimumHeight(base->sizeHint().height() + 4);
+  setMinimumHeight(grid->sizeHint().height() + 4);
+  updateVisibleTracks();
 }
 
 void TrackList::resizeEvent(QResizeEvent* e)
 {
   QScrollArea::resizeEvent(e);
   header->resize(width() - 2, viewportMargins().top() - 1);
+  updateVisibleTracks();
 }
 
-void TrackList::selectSong(PlayerContext* ctx, quint32 addr, const QString& title)
+quint32 TrackList::visibleTracks() const
 {
-  qDeleteAll(tracks);
-  tracks.clear();
+  if (!isVisible()) {
+    return 0;
+  }
+  QRect view(grid->mapFrom(viewport(), QPoint(0, 0)), viewport()->size());
+  quint32 mask = 0;
+  int numTracks = grid->trackCount();
+  for (int i = 0; i < numTracks; i++) {
+    if (grid->rowRect(i).intersects(view)) {
+      mask |= 1U << i;
+    }
+  }
+  return mask;
+}
+
+void TrackList::updateVisibleTracks()
+{
+  quint32 mask = visibleTracks();
+  if (mask != lastVisibleTracks) {
+    lastVisibleTracks = mask;
+    emit visibleTracksChanged();
+  }
+}
 
+void TrackList::selectSong(PlayerContext* ctx, quint32 addr, const QString& title)
+{
   if (ctx) {
     header->setTrackName(QStringLiteral("[%1] %2").arg(formatAddress(addr)).arg(title));
-
-    int numTracks = int(ctx->seq.tracks.size());
-    for (int i = 0; i < numTracks; i++) {
-      TrackView* t = new TrackView(header, i, this);
-      tracks << t;
-      trackLayout->insertWidget(i, t);
-      QObject::connect(t, SIGNAL(muteToggled(int,bool)), this, SLOT(onMuteToggled(int,bool)));
-      QObject::connect(t, SIGNAL(soloToggled(int,bool)), this, SLOT(soloToggled(int,bool)));
-    }
-
-    update(ctx, nullptr);
+    grid->setTrackCount(int(ctx->seq.tracks.size()));
   } else {
     header->setTrackName(QString());
+    grid->setTrackCount(0);
   }
+  // the grid is only resized once the scroll area lays it out again
+  QTimer::singleShot(0, this, SLOT(updateVisibleTracks()));
 }
 
-void TrackList::update(PlayerContext* ctx, VUState* vu)
+void TrackList::update(const SongSnapshot* snapshot)
 {
-  int numTracks = tracks.size();
-  if (vu) {
-    for (int i = 0; i < numTracks; i++) {
-      tracks[i]->update(ctx, vu->track[i].left, vu->track[i].right);
-    }
-  } else {
-    for (int i = 0; i < numTracks; i++) {
-      tracks[i]->update(ctx, 0, 0);
-    }
-  }
+  grid->updateTracks(snapshot);
 }
 
 void TrackList::onMuteToggled(int track, bool on)
 {
   emit muteToggled(track, on);
   if (!on) {
-    int numTracks = tracks.length();
-    for (int i = 0; i < numTracks; i++) {
-      tracks[i]->clearSolo();
-    }
+    grid->clearSolo();
   }
 }
 
 void TrackList::soloToggled(int track, bool on)
 {
-  int numTracks = tracks.length();
-  for (int i = 0; i < numTracks; i++) {
-    emit muteToggled(i, on ? (i != track) : false);
-  }
+  // sent as one change so every track switches at the same sample
+  emit soloChanged(track, on);
 }
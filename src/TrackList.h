@@ -2,12 +2,10 @@
 
 #include <QScrollArea>
 #include <QModelIndex>
-#include <QVector>
-class QVBoxLayout;
-class TrackView;
+class TrackGrid;
 class TrackHeader;
 class PlayerContext;
-class VUState;
+struct SongSnapshot;
 
 class TrackList : public QScrollArea
 {
@@ -16,17 +14,21 @@ public:
   TrackList(QWidget* parent = nullptr);
 
   QSize sizeHint() const;
+  quint32 visibleTracks() const;
 
 signals:
   void muteToggled(int track, bool on);
+  void soloChanged(int track, bool on);
+  void visibleTracksChanged();
 
 public slots:
   void selectSong(PlayerContext* ctx, quint32 addr, const QString& title);
-  void update(PlayerContext* ctx, VUState* vu);
+  void update(const SongSnapshot* snapshot);
 
 private slots:
   void onMuteToggled(int track, bool on);
   void soloToggled(int track, bool on);
+  void updateVisibleTracks();
 
 protected:
   void showEvent(QShowEvent*);
@@ -34,7 +36,6 @@ protected:
 
 private:
   TrackHeader* header;
-  QWidget* base;
-  QVBoxLayout* trackLayout;
-  QVector<TrackView*> tracks;
+  TrackGrid* grid;
+  quint32 lastVisibleTracks;
 };
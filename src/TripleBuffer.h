@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+
+// Lock-free handoff of the latest value from one producer thread to one
+// consumer thread. The producer fills writeBuffer() and calls publish(); the
+// consumer calls update() and then reads readBuffer(). Neither side ever
+// waits, and each slot sits on its own cache line.
+template <typename T>
+class TripleBuffer
+{
+public:
+  TripleBuffer() : back(0), front(2), middle(1) {}
+
+  T& writeBuffer()
+  {
+    return slots[back].value;
+  }
+
+  void publish()
+  {
+    back = middle.exchange(back | dirtyFlag, std::memory_order_acq_rel) & indexMask;
+  }
+
+  // Returns true if a new value was published since the last call.
+  bool update()
+  {
+    if (!(middle.load(std::memory_order_relaxed) & dirtyFlag)) {
+      return false;
+    }
+    front = middle.exchange(front, std::memory_order_acq_rel) & indexMask;
+    return true;
+  }
+
+  const T& readBuffer() const
+  {
+    return slots[front].value;
+  }
+
+private:
+  static constexpr int indexMask = 3;
+  static constexpr int dirtyFlag = 4;
+
+  struct alignas(64) Slot {
+    T value;
+  };
+
+  Slot slots[3];
+  int back;
+  alignas(64) int front;
+  alignas(64) std::atomic<int> middle;
+};
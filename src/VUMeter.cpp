@@ -3,36 +3,39 @@
 #include <QLinearGradient>
 
 VUState::VUState()
-: masterLoudness(10.0f)
+: masterLoudness(10.0f), visibleTracks(~0U), masterVisible(true), sampleRate(0)
 {
-  // initializers only
+  // The mixer resizes the meters when it advances to the next song, so make
+  // room for the largest track limit ConfigManager allows.
+  loudness.reserve(16);
 }
 
-void VUState::setTrackCount(int numTracks)
+void VUState::setSampleRate(double rate)
 {
-  loudness.clear();
-  for (int i = 0; i < numTracks; i++) {
-    loudness.emplace_back(5.0f);
+  sampleRate = rate;
+  masterLoudness.setSampleRate(sampleRate);
+  for (LevelMeter& meter : loudness) {
+    meter.setSampleRate(sampleRate);
   }
-  track = std::vector<sample>(numTracks);
 }
 
-void VUState::reset()
+void VUState::setTrackCount(int numTracks)
 {
-  masterLoudness.Reset();
-  for (LoudnessCalculator& c : loudness) {
-    c.Reset();
+  // keeps the existing meters so changing songs doesn't reallocate
+  loudness.resize(numTracks, LevelMeter(5.0f));
+  for (LevelMeter& meter : loudness) {
+    meter.reset();
+    if (sampleRate > 0) {
+      meter.setSampleRate(sampleRate);
+    }
   }
-  update();
 }
 
-void VUState::update()
+void VUState::reset()
 {
-  masterLoudness.GetLoudness(master.left, master.right);
-  std::size_t numTracks = loudness.size();
-  for (std::size_t i = 0; i < numTracks; i++) {
-    sample& level = track[i];
-    loudness[i].GetLoudness(level.left, level.right);
+  masterLoudness.reset();
+  for (LevelMeter& meter : loudness) {
+    meter.reset();
   }
 }
 
@@ -48,16 +51,37 @@ void VUMeter::setStereoLayout(Qt::Orientation a)
   update();
 }
 
+int VUMeter::levelExtent(int width, Qt::Orientation stereo, double level)
+{
+  if (stereo == Qt::Horizontal) {
+    return int((width / 2 - 6) * level);
+  }
+  return int(width * level);
+}
+
+int VUMeter::levelExtent(double level) const
+{
+  return levelExtent(width(), stereo, level);
+}
+
 void VUMeter::setLeft(double v)
 {
-  leftLevel = v > 1.0 ? 1.0 : v;
-  update();
+  v = v > 1.0 ? 1.0 : v;
+  bool changed = levelExtent(v) != levelExtent(leftLevel);
+  leftLevel = v;
+  if (changed) {
+    update();
+  }
 }
 
 void VUMeter::setRight(double v)
 {
-  rightLevel = v > 1.0 ? 1.0 : v;
-  update();
+  v = v > 1.0 ? 1.0 : v;
+  bool changed = levelExtent(v) != levelExtent(rightLevel);
+  rightLevel = v;
+  if (changed) {
+    update();
+  }
 }
 
 void VUMeter::setMute(bool m)
@@ -72,32 +96,42 @@ void VUMeter::setMute(bool m)
 void VUMeter::paintEvent(QPaintEvent*)
 {
   QPainter p(this);
-  int w = width();
-  int h = height() - 2;
-  p.fillRect(rect(), Qt::black);
+  paintLevels(&p, size(), stereo, leftLevel, rightLevel, leftGradient, rightGradient);
+}
+
+void VUMeter::resizeEvent(QResizeEvent*)
+{
+  makeGradients(width(), stereo, muted, &leftGradient, &rightGradient);
+}
+
+void VUMeter::paintLevels(QPainter* p, const QSize& size, Qt::Orientation stereo, double leftLevel, double rightLevel, const QBrush& leftGradient, const QBrush& rightGradient)
+{
+  int w = size.width();
+  int h = size.height() - 2;
+  p->fillRect(QRect(QPoint(0, 0), size), Qt::black);
 
   if (stereo == Qt::Horizontal) {
     int span = w / 2 - 6;
 
     double l = span * leftLevel;
-    p.fillRect(span - l, 1, l, h, leftGradient);
+    p->fillRect(span - l, 1, l, h, leftGradient);
 
     double r = span * rightLevel;
-    p.fillRect(w - span, 1, r, h, rightGradient);
+    p->fillRect(w - span, 1, r, h, rightGradient);
 
     int barWidth = w - span * 2;
-    p.fillRect(span + 3, 1, barWidth - 7, h, Qt::green);
+    p->fillRect(span + 3, 1, barWidth - 7, h, Qt::green);
   } else {
     int barHeight = h / 2 - 1;
-    p.fillRect(1, 1, w * leftLevel, barHeight, rightGradient);
-    p.fillRect(1, h - barHeight + 1, w * rightLevel, barHeight, rightGradient);
+    p->fillRect(1, 1, w * leftLevel, barHeight, rightGradient);
+    p->fillRect(1, h - barHeight + 1, w * rightLevel, barHeight, rightGradient);
   }
 }
 
-void VUMeter::resizeEvent(QResizeEvent*)
+void VUMeter::makeGradients(int width, Qt::Orientation stereo, bool muted, QBrush* leftGradient, QBrush* rightGradient)
 {
   int v = muted ? 128 : 255;
-  double w = width();
+  double w = width;
   double channelWidth = stereo == Qt::Horizontal ? w / 2 : 0;
 
   QLinearGradient left(0, 0, channelWidth, 0);
@@ -105,12 +139,12 @@ void VUMeter::resizeEvent(QResizeEvent*)
   left.setColorAt(0.25, QColor(v, v, 0));
   left.setColorAt(0.75, QColor(0, v, 0));
   left.setColorAt(1, QColor(0, v, 0));
-  leftGradient = left;
+  *leftGradient = left;
 
   QLinearGradient right(channelWidth, 0, w, 0);
   right.setColorAt(1, QColor(v, 0, 0));
   right.setColorAt(0.25, QColor(0, v, 0));
   right.setColorAt(0.75, QColor(v, v, 0));
   right.setColorAt(0, QColor(0, v, 0));
-  rightGradient = right;
+  *rightGradient = right;
 }
@@ -2,21 +2,29 @@
 
 #include <QWidget>
 #include <QBrush>
-#include "LoudnessCalculator.h"
+class QPainter;
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include "MixKernel.h"
 
 struct VUState
 {
   VUState();
 
+  void setSampleRate(double sampleRate);
   void setTrackCount(int tracks);
   void reset();
-  void update();
 
-  sample master;
-  std::vector<sample> track;
+  LevelMeter masterLoudness;
+  std::vector<LevelMeter> loudness;
 
-  LoudnessCalculator masterLoudness;
-  std::vector<LoudnessCalculator> loudness;
+  // written by the GUI, read by the mixer to skip meters nobody can see
+  std::atomic<std::uint32_t> visibleTracks;
+  std::atomic<bool> masterVisible;
+
+private:
+  double sampleRate;
 };
 
 class VUMeter : public QWidget
@@ -25,6 +33,10 @@ Q_OBJECT
 public:
   VUMeter(QWidget* parent = nullptr);
 
+  static int levelExtent(int width, Qt::Orientation stereo, double level);
+  static void makeGradients(int width, Qt::Orientation stereo, bool muted, QBrush* leftGradient, QBrush* rightGradient);
+  static void paintLevels(QPainter* p, const QSize& size, Qt::Orientation stereo, double left, double right, const QBrush& leftGradient, const QBrush& rightGradient);
+
 public slots:
   void setStereoLayout(Qt::Orientation a);
   void setMute(bool m);
@@ -36,6 +48,8 @@ protected:
   void resizeEvent(QResizeEvent*);
 
 private:
+  int levelExtent(double level) const;
+
   double leftLevel, rightLevel;
   bool muted;
   Qt::Orientation stereo;
@@ -1,10 +1,11 @@
 #include <QApplication>
 #include <QMessageBox>
+#include <QElapsedTimer>
+#include <QTimer>
 #include <iostream>
 #include <cstring>
 #include <cstdio>
 #include <clocale>
-#include <portaudio.h>
 
 #include "PlayerWindow.h"
 #include "Player.h"
@@ -16,8 +17,19 @@
 #define STRINGIFY(x) STRINGIFY_(x)
 #define AGBPLAY_VERSION_STRING STRINGIFY(AGBPLAY_VERSION)
 
+static QElapsedTimer startupTimer;
+static bool startupTrace = false;
+
+static void traceStartup(const char* step)
+{
+  if (startupTrace) {
+    std::fprintf(stderr, "startup: %5lld ms  %s\n", (long long)startupTimer.elapsed(), step);
+  }
+}
+
 int main(int argc, char** argv)
 {
+  startupTimer.start();
   QCoreApplication::setApplicationName("agbplay");
   QCoreApplication::setApplicationVersion(AGBPLAY_VERSION_STRING);
   QCoreApplication::setOrganizationName("ipatix");
@@ -26,43 +38,39 @@ int main(int argc, char** argv)
   QApplication app(argc, argv);
   app.setWindowIcon(QIcon(":/logo.png"));
 
+  QStringList args = app.arguments();
+  startupTrace = args.removeAll("--startup-trace") > 0;
+  traceStartup("QApplication created");
+
   if (!Debug::open("/dev/stderr") && !Debug::open(nullptr)) {
     QMessageBox::critical(nullptr, "agbplay-gui", PlayerWindow::tr("Debug Init failed"));
     return EXIT_FAILURE;
   }
 
   setlocale(LC_ALL, "");
-  if (Pa_Initialize() != paNoError) {
-    QMessageBox::critical(nullptr, "agbplay-gui", PlayerWindow::tr("Couldn't init portaudio"));
-    return EXIT_FAILURE;
-  }
 
   int result;
   /* scope */ {
+    // PortAudio is initialized and the output device probed on first play
     Player player;
-    try {
-      player.detectHostApi();
-    } catch (std::exception& e) {
-      QMessageBox::critical(nullptr, "agbplay-gui", e.what());
-      return EXIT_FAILURE;
-    }
 
     std::cout << "Loading Config..." << std::endl;
     ConfigManager::Instance().Load();
+    traceStartup("config loaded");
 
     PlayerWindow wgui(&player);
     wgui.show();
+    traceStartup("window shown");
 
-    QStringList args = app.arguments();
     if (args.length() > 1) {
       wgui.openRom(args[1]);
+      traceStartup("ROM opened");
     }
 
+    QTimer::singleShot(0, [] { traceStartup("event loop running"); });
     result = app.exec();
   }
 
-  if (Pa_Terminate() != paNoError)
-      std::cerr << "Error while terminating portaudio" << std::endl;
   Debug::close();
   return result;
 }
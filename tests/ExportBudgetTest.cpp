@@ -0,0 +1,45 @@
+#include "ExportBudget.h"
+#include <cstdio>
+
+static int failures = 0;
+
+static void expect(const char* name, ExportBudget::Stop actual, ExportBudget::Stop expected)
+{
+  if (actual != expected) {
+    std::fprintf(stderr, "FAIL: %s: got %d, expected %d\n", name, int(actual), int(expected));
+    failures++;
+  }
+}
+
+int main()
+{
+  using Stop = ExportBudget::Stop;
+  const double rate = 13379.0;
+
+  ExportBudget unlimited{ 0, 0 };
+  expect("no limits", unlimited.check(std::uint64_t(rate * 100000), rate, 100000000), Stop::None);
+
+  ExportBudget audio{ 10, 0 };
+  expect("under the audio limit", audio.check(std::uint64_t(rate * 10) - 1, rate, 0), Stop::None);
+  expect("at the audio limit", audio.check(std::uint64_t(rate * 10), rate, 0), Stop::AudioLimit);
+  expect("audio limit ignores time", audio.check(0, rate, 100000000), Stop::None);
+
+  ExportBudget time{ 0, 2.5 };
+  expect("under the time limit", time.check(0, rate, 2499), Stop::None);
+  expect("at the time limit", time.check(0, rate, 2500), Stop::TimeLimit);
+  expect("time limit ignores audio", time.check(std::uint64_t(rate * 100000), rate, 0), Stop::None);
+
+  ExportBudget both{ 10, 2.5 };
+  expect("audio limit first", both.check(std::uint64_t(rate * 10), rate, 2500), Stop::AudioLimit);
+  expect("time limit alone", both.check(0, rate, 2500), Stop::TimeLimit);
+
+  // a limit shorter than one frame or millisecond rounds down to no limit
+  ExportBudget tiny{ 0.5 / rate, 0.0001 };
+  expect("sub-frame limits", tiny.check(1, rate, 1), Stop::None);
+
+  if (failures) {
+    return 1;
+  }
+  std::printf("ExportBudgetTest: all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,11 @@
+TEMPLATE = app
+TARGET = ExportBudgetTest
+QT =
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+OBJECTS_DIR = .build
+INCLUDEPATH += $${_PRO_FILE_PWD_}/../src
+QMAKE_CXXFLAGS += -Wall -Wextra
+
+HEADERS += ../src/ExportBudget.h
+SOURCES += ../src/ExportBudget.cpp ExportBudgetTest.cpp